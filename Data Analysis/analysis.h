@@ -0,0 +1,60 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+// Options and entry points of the analyses, shared by the ROOT macros (histograms(), efficiency(),
+// plotsHV() call them with the default options) and the gral_analysis executable.
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <ROOT/RDataFrame.hxx>
+#include "detectorSetup.h"
+#include "runBatch.h"
+
+struct AnalysisOptions {
+    std::string runList = kDefaultRunList;
+    std::string mapFile = kDefaultMapFile;
+    std::string maskFile = kDefaultMaskFile; // the default is used if it exists; empty for no mask
+    std::string geometryFile = kDefaultGeometryFile;
+    std::vector<int> detectors;         // APV ids of the detectors to analyse; all DUTs if empty
+    unsigned int threads = 8;           // 0 for all cores
+    unsigned int bootstrapReplicas = 0; // see bootstrap.h
+    ClusterSettings clustering;         // see stripClustering.h
+};
+
+// Detector setup restricted to the detectors of the options. Returns a setup without mapping
+// (and prints the reason) if the mapping cannot be read or a detector is not a DUT.
+inline DetectorSetup loadDetectorSetup(const AnalysisOptions& options)
+{
+    DetectorSetup setup = loadDetectorSetup(options.mapFile, options.maskFile, options.geometryFile);
+    if (!setup.mapping) return setup;
+    setup.bootstrapReplicas = options.bootstrapReplicas;
+    setup.clustering = options.clustering;
+    if (options.detectors.empty()) return setup;
+
+    for (int id : options.detectors) {
+        if (std::find(setup.ids.begin(), setup.ids.end(), id) == setup.ids.end()) {
+            std::cerr << "Detector " << id << " is not a DUT of " << options.mapFile << std::endl;
+            return DetectorSetup();
+        }
+    }
+    std::vector<int> ids;
+    for (int id : setup.ids) {
+        if (std::find(options.detectors.begin(), options.detectors.end(), id) != options.detectors.end()) ids.push_back(id);
+    }
+    setup.ids = ids;
+    return setup;
+}
+
+inline void enableThreads(const AnalysisOptions& options)
+{
+    if (options.threads != 1) ROOT::EnableImplicitMT(options.threads);
+}
+
+// Implemented in histograms.cpp, efficiency.C and plotsHV.C.
+void runHistograms(const std::string& runFile, const AnalysisOptions& options);
+int runEfficiency(const AnalysisOptions& options);
+void runHVScan(const AnalysisOptions& options);
+
+#endif
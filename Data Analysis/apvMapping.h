@@ -0,0 +1,162 @@
+#ifndef APV_MAPPING_H
+#define APV_MAPPING_H
+
+// Channel-to-strip mapping of the setup, read from the mapping file (Data/Cosmics_2024.map).
+//
+// The file has one column per APV: an "APVid:" row with the APV ids (-1 for unused columns),
+// a "Chamber:" row with the chamber read out by each APV, then 128 rows "channel strip strip ..."
+// giving the strip connected to each channel. Lines starting with '#' are comments.
+// ApvMapping flattens it into lookup tables indexed by (apv_id, apv_ch), so decoding a hit is
+// an array load instead of handling the mm_id strings of the raw tree.
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+enum Chamber : uint8_t {
+    kTrkInX, kTrkInY, kTrkOutX, kTrkOutY,
+    kDut01, kDut02, kDut03, kDut04, kDut05, kDut06,
+    kCsX, kCsY, kRm3, kRm7,
+    kNumChambers,
+    kNoChamber = 0xFF
+};
+
+const char* const kChamberNames[kNumChambers] = {
+    "TRK_IN_X", "TRK_IN_Y", "TRK_OUT_X", "TRK_OUT_Y",
+    "DUT_01", "DUT_02", "DUT_03", "DUT_04", "DUT_05", "DUT_06",
+    "CS_X", "CS_Y", "RM3", "RM7"
+};
+
+const unsigned int kNumApvs = 18;
+const unsigned int kApvChannels = 128;
+const char* const kDefaultMapFile = "Data/Cosmics_2024.map";
+
+inline Chamber chamberFromName(const std::string& name)
+{
+    for (int c = 0; c < kNumChambers; ++c) {
+        if (name == kChamberNames[c]) return Chamber(c);
+    }
+    return kNoChamber;
+}
+
+class ApvMapping {
+public:
+    // Reads a mapping file; returns nullptr (and prints the reason) if it cannot be parsed.
+    static std::shared_ptr<const ApvMapping> Load(const std::string& path)
+    {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "Error opening mapping file: " << path << std::endl;
+            return nullptr;
+        }
+
+        std::shared_ptr<ApvMapping> mapping(new ApvMapping());
+        std::vector<int> apvs;
+        std::vector<std::string> chambers;
+        std::string line;
+        int lineNumber = 0;
+
+        while (std::getline(in, line)) {
+            lineNumber++;
+            std::istringstream tokens(line);
+            std::string first;
+            if (!(tokens >> first) || first[0] == '#') continue;
+
+            if (first == "APVid:") {
+                for (int id; tokens >> id;) apvs.push_back(id);
+            } else if (first == "Chamber:") {
+                for (std::string name; tokens >> name;) chambers.push_back(name);
+                if (chambers.size() != apvs.size()) {
+                    std::cerr << path << ":" << lineNumber << ": expected " << apvs.size() << " chambers" << std::endl;
+                    return nullptr;
+                }
+                for (size_t col = 0; col < apvs.size(); ++col) {
+                    if (apvs[col] < 0) continue;
+                    Chamber chamber = chamberFromName(chambers[col]);
+                    if (apvs[col] >= (int)kNumApvs || chamber == kNoChamber) {
+                        std::cerr << path << ":" << lineNumber << ": unknown APV " << apvs[col]
+                                  << " or chamber " << chambers[col] << std::endl;
+                        return nullptr;
+                    }
+                    mapping->fApvChamber[apvs[col]] = chamber;
+                }
+            } else {
+                int channel = -1;
+                std::istringstream(first) >> channel;
+                if (channel < 0 || channel >= (int)kApvChannels || chambers.empty()) {
+                    std::cerr << path << ":" << lineNumber << ": unexpected channel row" << std::endl;
+                    return nullptr;
+                }
+                for (size_t col = 0; col < apvs.size(); ++col) {
+                    int strip;
+                    if (!(tokens >> strip)) {
+                        std::cerr << path << ":" << lineNumber << ": expected " << apvs.size() << " strips" << std::endl;
+                        return nullptr;
+                    }
+                    if (apvs[col] < 0) continue;
+                    size_t index = apvs[col] * kApvChannels + channel;
+                    mapping->fChamber[index] = mapping->fApvChamber[apvs[col]];
+                    mapping->fStrip[index] = strip;
+                }
+            }
+        }
+
+        return mapping;
+    }
+
+    // Chamber and strip of a channel; kNoChamber for channels that are not mapped.
+    Chamber GetChamber(unsigned int apv, unsigned int channel) const
+    {
+        return apv < kNumApvs && channel < kApvChannels ? fChamber[apv * kApvChannels + channel] : kNoChamber;
+    }
+
+    uint16_t GetStrip(unsigned int apv, unsigned int channel) const
+    {
+        return apv < kNumApvs && channel < kApvChannels ? fStrip[apv * kApvChannels + channel] : 0;
+    }
+
+    Chamber GetApvChamber(unsigned int apv) const { return apv < kNumApvs ? fApvChamber[apv] : kNoChamber; }
+
+    // APVs reading out a chamber, in increasing order.
+    std::vector<int> GetApvs(Chamber chamber) const
+    {
+        std::vector<int> apvs;
+        for (unsigned int apv = 0; apv < kNumApvs; ++apv) {
+            if (fApvChamber[apv] == chamber) apvs.push_back(apv);
+        }
+        return apvs;
+    }
+
+private:
+    ApvMapping() : fChamber(kNumApvs * kApvChannels, kNoChamber), fStrip(kNumApvs * kApvChannels, 0), fApvChamber(kNumApvs, kNoChamber) {}
+
+    std::vector<Chamber> fChamber;
+    std::vector<uint16_t> fStrip;
+    std::vector<Chamber> fApvChamber;
+};
+
+// FNV-1a hash of the chamber and strip of every channel, identifying the mapping a hit cache
+// or cached result was made with.
+inline uint64_t mappingFingerprint(const ApvMapping& mapping)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](unsigned int value) {
+        for (int byte = 0; byte < 4; ++byte) {
+            hash ^= (value >> (8 * byte)) & 0xFF;
+            hash *= 1099511628211ull;
+        }
+    };
+    for (unsigned int apv = 0; apv < kNumApvs; ++apv) {
+        for (unsigned int ch = 0; ch < kApvChannels; ++ch) {
+            add(mapping.GetChamber(apv, ch));
+            add(mapping.GetStrip(apv, ch));
+        }
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef APV_SIGNAL_H
+#define APV_SIGNAL_H
+
+// Pedestal subtraction and peak finding for the APV25 time samples of all hits of an event.
+//
+// The samples are passed as one contiguous block in sample-major order: row t holds time
+// sample t of every hit, rows are `stride` shorts apart, so the hits of an event are the
+// SIMD lanes. For every hit the kernel computes
+//   pedestal  mean of the first nPresamples samples (0 without presamples)
+//   maxQ      maximum sample minus the pedestal
+//   peakBin   time sample of the maximum (first one if several are equal)
+//   integral  sum of the pedestal-subtracted samples after the presamples
+// With AVX2 enabled at compile time (-mavx2 or -march=native) eight hits are processed per
+// instruction; otherwise the scalar loop computes the same quantities hit by hit.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Hits processed per AVX2 iteration.
+const size_t kApvSignalLanes = 8;
+
+struct ApvSignalOutput {
+    int16_t* maxQ;
+    uint8_t* peakBin;
+    float* pedestal;
+    float* integral;
+};
+
+inline int16_t apvClampCharge(float q)
+{
+    return (int16_t)std::max(-32768.f, std::min(32767.f, std::nearbyint(q)));
+}
+
+// Scalar version, also used for the hits left over after the AVX2 loop.
+inline void apvSignalScalar(const int16_t* samples, size_t stride, size_t begin, size_t end,
+                            unsigned int nSamples, unsigned int nPresamples, const ApvSignalOutput& out)
+{
+    for (size_t i = begin; i < end; ++i) {
+        int32_t pedSum = 0, sum = 0, max = INT32_MIN, peak = 0;
+        for (unsigned int t = 0; t < nSamples; ++t) {
+            int32_t q = samples[t * stride + i];
+            if (t < nPresamples) pedSum += q;
+            else sum += q;
+            if (q > max) {
+                max = q;
+                peak = t;
+            }
+        }
+
+        float pedestal = nPresamples > 0 ? pedSum * (1.f / nPresamples) : 0.f;
+        out.pedestal[i] = pedestal;
+        out.maxQ[i] = nSamples > 0 ? apvClampCharge(max - pedestal) : 0;
+        out.peakBin[i] = peak;
+        out.integral[i] = sum - pedestal * (nSamples - nPresamples);
+    }
+}
+
+inline void apvSignal(const int16_t* samples, size_t stride, size_t nHits, unsigned int nSamples,
+                      unsigned int nPresamples, const ApvSignalOutput& out)
+{
+    nPresamples = std::min(nPresamples, nSamples);
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    if (nSamples > 0) {
+        const __m256 invPre = _mm256_set1_ps(nPresamples > 0 ? 1.f / nPresamples : 0.f);
+        const __m256 nSignal = _mm256_set1_ps(nSamples - nPresamples);
+
+        for (; i + kApvSignalLanes <= nHits; i += kApvSignalLanes) {
+            __m256i pedSum = _mm256_setzero_si256();
+            __m256i sum = _mm256_setzero_si256();
+            __m256i max = _mm256_set1_epi32(INT32_MIN);
+            __m256i peak = _mm256_setzero_si256();
+
+            for (unsigned int t = 0; t < nSamples; ++t) {
+                __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + t * stride + i));
+                __m256i q = _mm256_cvtepi16_epi32(raw);
+                if (t < nPresamples) pedSum = _mm256_add_epi32(pedSum, q);
+                else sum = _mm256_add_epi32(sum, q);
+
+                __m256i higher = _mm256_cmpgt_epi32(q, max);
+                max = _mm256_max_epi32(max, q);
+                peak = _mm256_blendv_epi8(peak, _mm256_set1_epi32(t), higher);
+            }
+
+            __m256 pedestal = _mm256_mul_ps(_mm256_cvtepi32_ps(pedSum), invPre);
+            __m256 maxQ = _mm256_sub_ps(_mm256_cvtepi32_ps(max), pedestal);
+            __m256 integral = _mm256_sub_ps(_mm256_cvtepi32_ps(sum), _mm256_mul_ps(pedestal, nSignal));
+
+            alignas(32) float maxQLanes[kApvSignalLanes];
+            alignas(32) int32_t peakLanes[kApvSignalLanes];
+            _mm256_storeu_ps(out.pedestal + i, pedestal);
+            _mm256_storeu_ps(out.integral + i, integral);
+            _mm256_store_ps(maxQLanes, maxQ);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(peakLanes), peak);
+            for (size_t lane = 0; lane < kApvSignalLanes; ++lane) {
+                out.maxQ[i + lane] = apvClampCharge(maxQLanes[lane]);
+                out.peakBin[i + lane] = peakLanes[lane];
+            }
+        }
+    }
+#endif
+
+    apvSignalScalar(samples, stride, i, nHits, nSamples, nPresamples, out);
+}
+
+#endif
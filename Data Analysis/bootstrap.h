@@ -0,0 +1,214 @@
+#ifndef BOOTSTRAP_H
+#define BOOTSTRAP_H
+
+// Poisson bootstrap of the per-detector efficiencies and means, computed in the same event loop as
+// the histograms.
+//
+// Every event enters each of R replicas with a weight drawn from Poisson(1), which resamples the
+// events of the run with replacement without a second pass. Per replica, BootstrapAccumulator
+// keeps weighted sums of a few per-event quantities of every detector (fired, hits, charge,
+// leading cluster size, telescope tracks and matches); the estimates are ratios of these sums. The
+// spread of the replica estimates gives the uncertainty, as a percentile interval, which stays
+// valid near 100% efficiency and for skewed charge spectra. The means are unbinned, so they are
+// not affected by the histogram ranges. The nominal sample (all weights 1) is always accumulated,
+// also without replicas, and gives the values and their standard errors in that case, so that the
+// points do not depend on the error mode. One accumulator per slot, with its own generators, merged at the end: as
+// the events are distributed over the slots at run time, the replicas of multithreaded runs
+// differ between executions, the intervals only within their statistical precision.
+//
+// The replicas are the innermost, contiguous dimension of the sums, and every replica has its own
+// 32-bit xorshift generator, so drawing the weights and adding an event are loops over the
+// replicas without dependencies between them, which the compiler vectorizes.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Per-event sums of one detector. All but the tracking sums are 0 in the events in which the
+// trigger did not fire.
+enum BootstrapSum {
+    kSumTriggered,     // 1 if the trigger fired
+    kSumFired,         // 1 if the detector has hits
+    kSumHits,          // number of hits
+    kSumCharge,        // sum of the maxQ of the hits
+    kSumCharge2,       // its square
+    kSumClusterSize,   // strips of the leading cluster
+    kSumClusterSize2,  // its square
+    kSumClustered,     // 1 if the detector has a cluster
+    kSumTracks,        // telescope tracks in the acceptance of the detector
+    kSumMatched,       // those matched by a cluster of the detector
+    kNumBootstrapSums
+};
+
+// Estimates computed from the sums.
+enum BootstrapQuantity {
+    kBootEfficiency,          // fired / triggered events, in %
+    kBootHits,                // hits per event with hits
+    kBootMaxQ,                // maxQ per hit
+    kBootTotalQ,              // sum of maxQ per event with hits
+    kBootClusterSize,         // leading cluster size per event with a cluster
+    kBootTrackingEfficiency,  // matched / tracks, in %
+    kNumBootstrapQuantities
+};
+
+// Estimate with the uncertainty interval [value - errorLow, value + errorHigh].
+struct Estimate {
+    double value;
+    double errorLow;
+    double errorHigh;
+};
+
+// Nominal estimates (all weights 1) with their standard errors, and replica estimates of one
+// detector. The standard errors are binomial for the efficiencies and stddev/sqrt(N) for the
+// total charge and cluster size; the hits and maxQ have none (0).
+struct BootstrapSamples {
+    double nominal[kNumBootstrapQuantities] = {};
+    double standardError[kNumBootstrapQuantities] = {};
+    std::vector<double> replicas[kNumBootstrapQuantities];
+};
+
+// Nominal value of a quantity with the central `level` percentile interval of its replicas, or
+// with its standard error without replicas.
+inline Estimate bootstrapEstimate(const BootstrapSamples& samples, BootstrapQuantity quantity, double level = 0.6827)
+{
+    double value = samples.nominal[quantity];
+    std::vector<double> sorted;
+    for (double r : samples.replicas[quantity]) {
+        if (std::isfinite(r)) sorted.push_back(r);
+    }
+    if (sorted.empty()) return {value, samples.standardError[quantity], samples.standardError[quantity]};
+    std::sort(sorted.begin(), sorted.end());
+
+    auto quantile = [&sorted](double q) {
+        double pos = q * (sorted.size() - 1);
+        size_t i = (size_t)pos;
+        double f = pos - i;
+        return i + 1 < sorted.size() ? sorted[i] * (1 - f) + sorted[i + 1] * f : sorted[i];
+    };
+    double low = quantile((1 - level) / 2), high = quantile((1 + level) / 2);
+    return {value, std::max(value - low, 0.), std::max(high - value, 0.)};
+}
+
+// Poisson(1) weights for n replicas, one xorshift32 generator per replica, by inverting the
+// cumulative distribution with branch-free comparisons.
+class PoissonWeights {
+public:
+    PoissonWeights(unsigned int n, uint64_t seed) : fState(n)
+    {
+        // Seeds from splitmix64; xorshift32 needs a non-zero state.
+        for (unsigned int r = 0; r < n; ++r) {
+            seed += 0x9E3779B97F4A7C15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            fState[r] = (uint32_t)(z ^ (z >> 31)) | 1u;
+        }
+
+        // P(k <= n) for Poisson(1), scaled to 32 bits; weights above 8 have probability < 1e-5.
+        double p = std::exp(-1.), cdf = 0.;
+        for (int k = 0; k < kMaxWeight; ++k) {
+            cdf += p;
+            p /= k + 1;
+            fThreshold[k] = (uint32_t)std::min(cdf * 4294967296., 4294967295.);
+        }
+    }
+
+    void Generate(double* weights)
+    {
+        uint32_t* state = fState.data();
+        for (size_t r = 0; r < fState.size(); ++r) {
+            uint32_t x = state[r];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            state[r] = x;
+
+            uint32_t k = 0;
+            for (int t = 0; t < kMaxWeight; ++t) k += x >= fThreshold[t];
+            weights[r] = k;
+        }
+    }
+
+private:
+    static const int kMaxWeight = 8;
+
+    std::vector<uint32_t> fState;
+    uint32_t fThreshold[kMaxWeight];
+};
+
+// Weighted sums of nReplicas replicas plus the nominal sample (weight 1), for nDetectors detectors;
+// nReplicas may be 0.
+class BootstrapAccumulator {
+public:
+    BootstrapAccumulator(unsigned int nDetectors, unsigned int nReplicas, uint64_t seed)
+        : fDetectors(nDetectors), fLanes(nReplicas + 1), fGenerator(nReplicas, seed), fWeights(fLanes),
+          fSums(nDetectors * kNumBootstrapSums * fLanes)
+    {
+    }
+
+    // Adds one event; sums[d * kNumBootstrapSums + s] is sum s of detector d for this event. Events
+    // whose sums are all 0 do not change any estimate and need not be added.
+    void Add(const double* sums)
+    {
+        double* w = fWeights.data();
+        fGenerator.Generate(w);
+        w[fLanes - 1] = 1.;
+
+        for (unsigned int i = 0; i < fDetectors * kNumBootstrapSums; ++i) {
+            double v = sums[i];
+            if (v == 0.) continue;
+            double* acc = &fSums[i * fLanes];
+            for (unsigned int r = 0; r < fLanes; ++r) acc[r] += w[r] * v;
+        }
+    }
+
+    void Merge(const BootstrapAccumulator& other)
+    {
+        for (size_t i = 0; i < fSums.size(); ++i) fSums[i] += other.fSums[i];
+    }
+
+    BootstrapSamples GetSamples(unsigned int detector) const
+    {
+        BootstrapSamples samples;
+        for (int q = 0; q < kNumBootstrapQuantities; ++q) samples.replicas[q].resize(fLanes - 1);
+
+        for (unsigned int r = 0; r < fLanes; ++r) {
+            auto sum = [&](BootstrapSum s) { return fSums[(detector * kNumBootstrapSums + s) * fLanes + r]; };
+            double value[kNumBootstrapQuantities];
+            value[kBootEfficiency] = sum(kSumTriggered) > 0 ? sum(kSumFired) / sum(kSumTriggered) * 100 : NAN;
+            value[kBootHits] = sum(kSumFired) > 0 ? sum(kSumHits) / sum(kSumFired) : NAN;
+            value[kBootMaxQ] = sum(kSumHits) > 0 ? sum(kSumCharge) / sum(kSumHits) : NAN;
+            value[kBootTotalQ] = sum(kSumFired) > 0 ? sum(kSumCharge) / sum(kSumFired) : NAN;
+            value[kBootClusterSize] = sum(kSumClustered) > 0 ? sum(kSumClusterSize) / sum(kSumClustered) : NAN;
+            value[kBootTrackingEfficiency] = sum(kSumTracks) > 0 ? sum(kSumMatched) / sum(kSumTracks) * 100 : NAN;
+
+            for (int q = 0; q < kNumBootstrapQuantities; ++q) {
+                if (r + 1 < fLanes) samples.replicas[q][r] = value[q];
+                else samples.nominal[q] = std::isfinite(value[q]) ? value[q] : 0.;
+            }
+            if (r + 1 < fLanes) continue;
+
+            const double* nominal = samples.nominal;
+            double* error = samples.standardError;
+            auto binomial = [](double n, double N) { return N > 0 ? std::sqrt(n / N * (1 - n / N) / N) * 100 : 0.; };
+            auto meanError = [](double sum2, double mean, double N) {
+                return N > 0 ? std::sqrt(std::max(sum2 / N - mean * mean, 0.) / N) : 0.;
+            };
+            error[kBootEfficiency] = binomial(sum(kSumFired), sum(kSumTriggered));
+            error[kBootTotalQ] = meanError(sum(kSumCharge2), nominal[kBootTotalQ], sum(kSumFired));
+            error[kBootClusterSize] = meanError(sum(kSumClusterSize2), nominal[kBootClusterSize], sum(kSumClustered));
+            error[kBootTrackingEfficiency] = binomial(sum(kSumMatched), sum(kSumTracks));
+        }
+        return samples;
+    }
+
+private:
+    unsigned int fDetectors;
+    unsigned int fLanes;
+    PoissonWeights fGenerator;
+    std::vector<double> fWeights;
+    std::vector<double> fSums; // [detector][sum][lane]
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef CHANNEL_MASK_H
+#define CHANNEL_MASK_H
+
+// Mask of noisy and dead channels, written by calibrateChannels.C (Data/channels.mask) and
+// applied by HitDecoder: hits of masked channels are dropped when an event is decoded, before
+// any analysis stage sees them.
+//
+// The file has one line per masked channel, "apv channel status [occupancy meanQ]", with status
+// "hot" or "dead"; the occupancy (hits per event) and mean maxQ measured by the calibration are
+// informative only. Lines starting with '#' are comments. Channels not listed are good.
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "apvMapping.h"
+
+enum ChannelStatus : uint8_t {
+    kChannelGood,
+    kChannelHot,   // fires far more often than the other channels of its APV
+    kChannelDead,  // (almost) never fires
+};
+
+const char* const kDefaultMaskFile = "Data/channels.mask";
+
+inline const char* channelStatusName(ChannelStatus status)
+{
+    return status == kChannelHot ? "hot" : status == kChannelDead ? "dead" : "good";
+}
+
+class ChannelMask {
+public:
+    // Reads a mask file; returns nullptr (and prints the reason) if it cannot be parsed.
+    static std::shared_ptr<const ChannelMask> Load(const std::string& path)
+    {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "Error opening channel mask: " << path << std::endl;
+            return nullptr;
+        }
+
+        std::shared_ptr<ChannelMask> mask(new ChannelMask());
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line)) {
+            lineNumber++;
+            std::istringstream tokens(line);
+            std::string first;
+            if (!(tokens >> first) || first[0] == '#') continue;
+
+            int apv = -1, channel = -1;
+            std::string status;
+            std::istringstream(first) >> apv;
+            tokens >> channel >> status;
+            if (apv < 0 || apv >= (int)kNumApvs || channel < 0 || channel >= (int)kApvChannels ||
+                (status != "hot" && status != "dead")) {
+                std::cerr << path << ":" << lineNumber << ": expected \"apv channel hot|dead\"" << std::endl;
+                return nullptr;
+            }
+            mask->fStatus[apv * kApvChannels + channel] = status == "hot" ? kChannelHot : kChannelDead;
+        }
+
+        // FNV-1a hash of the masked channels, 0 being reserved for "no mask".
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < mask->fStatus.size(); ++i) {
+            if (mask->fStatus[i] == kChannelGood) continue;
+            mask->fMasked++;
+            for (uint32_t value : {(uint32_t)i, (uint32_t)mask->fStatus[i]}) {
+                for (int byte = 0; byte < 4; ++byte) {
+                    hash ^= (value >> (8 * byte)) & 0xFF;
+                    hash *= 16777619u;
+                }
+            }
+        }
+        mask->fChecksum = hash ? hash : 1;
+        return mask;
+    }
+
+    ChannelStatus GetStatus(unsigned int apv, unsigned int channel) const
+    {
+        return apv < kNumApvs && channel < kApvChannels ? fStatus[apv * kApvChannels + channel] : kChannelGood;
+    }
+
+    bool IsMasked(unsigned int apv, unsigned int channel) const { return GetStatus(apv, channel) != kChannelGood; }
+
+    unsigned int GetNumMasked() const { return fMasked; }
+
+    // Identifies the set of masked channels, e.g. in the hit cache header and the result cache key.
+    uint32_t GetChecksum() const { return fChecksum; }
+
+private:
+    ChannelMask() : fStatus(kNumApvs * kApvChannels, kChannelGood) {}
+
+    std::vector<ChannelStatus> fStatus;
+    unsigned int fMasked = 0;
+    uint32_t fChecksum = 0;
+};
+
+// Checksum of an optional mask; 0 without mask.
+inline uint32_t channelMaskChecksum(const std::shared_ptr<const ChannelMask>& mask)
+{
+    return mask ? mask->GetChecksum() : 0;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef DETECTOR_SETUP_H
+#define DETECTOR_SETUP_H
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "apvMapping.h"
+#include "channelMask.h"
+#include "stripClustering.h"
+#include "telescopeTracking.h"
+
+// Detectors analysed by the macros: the DUT chambers of the mapping, named after their plane in
+// the stack (DUT_01 is plane 2, ..., DUT_06 is plane 7, between the tracker planes), and the
+// detector whose hits trigger an event to be analysed (DUT_06).
+// Also holds the channel mask applied when decoding and the settings of the analysis stages
+// that work on the decoded hits.
+struct DetectorSetup {
+    std::shared_ptr<const ApvMapping> mapping;
+    std::shared_ptr<const ChannelMask> mask; // null if no channels are masked
+    std::vector<int> ids;
+    std::map<int, std::string> idToName;
+    int triggerId = -1;
+    ClusterSettings clustering;
+    TrackingSettings tracking;
+    unsigned int bootstrapReplicas = 0; // Poisson bootstrap replicas (bootstrap.h), 0 to disable
+};
+
+const Chamber kTriggerChamber = kDut06;
+
+// Only the default mask file is optional: without it (or with an empty path) no channels are
+// masked. With an empty geometry path the default TrackingSettings are used.
+// Returns a setup without mapping (and no detectors) if the mapping file, the geometry file or
+// a mask file other than a missing default one cannot be read.
+inline DetectorSetup loadDetectorSetup(const std::string& mapFile = kDefaultMapFile,
+                                       const std::string& maskFile = kDefaultMaskFile,
+                                       const std::string& geometryFile = kDefaultGeometryFile)
+{
+    DetectorSetup setup;
+    struct stat st;
+    if (!maskFile.empty() && (maskFile != kDefaultMaskFile || stat(maskFile.c_str(), &st) == 0)) {
+        setup.mask = ChannelMask::Load(maskFile);
+        if (!setup.mask) return setup;
+    }
+    if (!geometryFile.empty() && !loadTrackingSettings(geometryFile, setup.tracking)) return setup;
+    setup.mapping = ApvMapping::Load(mapFile);
+    if (!setup.mapping) return setup;
+
+    for (int c = kDut01; c <= kDut06; ++c) {
+        for (int apv : setup.mapping->GetApvs(Chamber(c))) {
+            setup.ids.push_back(apv);
+            setup.idToName[apv] = std::to_string(c - kDut01 + 2);
+            if (c == kTriggerChamber) setup.triggerId = apv;
+        }
+    }
+
+    // Active strips of every chamber for the track acceptance.
+    bool mapped[kNumChambers] = {};
+    for (unsigned int apv = 0; apv < kNumApvs; ++apv) {
+        for (unsigned int ch = 0; ch < kApvChannels; ++ch) {
+            Chamber c = setup.mapping->GetChamber(apv, ch);
+            if (c == kNoChamber) continue;
+            float strip = setup.mapping->GetStrip(apv, ch);
+            setup.tracking.stripMin[c] = mapped[c] ? std::min(setup.tracking.stripMin[c], strip) : strip;
+            setup.tracking.stripMax[c] = mapped[c] ? std::max(setup.tracking.stripMax[c], strip) : strip;
+            mapped[c] = true;
+        }
+    }
+    return setup;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <TROOT.h>
+#include "analysis.h"
+
+using namespace std;
+
+// Compiled entry point of the analyses, built by CMakeLists.txt. Run it from this directory,
+// like the macros, since the data and figure paths are relative:
+//   ./build/gral_analysis efficiency --threads 16 --bootstrap 200
+
+void usage()
+{
+    cerr << "Usage: gral_analysis <command> [options]\n"
+         << "Commands:\n"
+         << "  histograms   hits and charge histograms of one run (Figures/histograms_*.png)\n"
+         << "  efficiency   efficiency vs HV of the run list (Efficiency_HV_*.png)\n"
+         << "  hvscan       cluster size and total charge vs HV of the run list (HV_vs_*.png)\n"
+         << "Options:\n"
+         << "  --run FILE         run for 'histograms' (default Data/run6578.root)\n"
+         << "  --runs FILE        run list with the HV of each run (default " << kDefaultRunList << ")\n"
+         << "  --map FILE         mapping file (default " << kDefaultMapFile << ")\n"
+         << "  --geometry FILE    tracking geometry (default " << kDefaultGeometryFile << ")\n"
+         << "  --mask FILE        channel mask, 'none' for no mask (default " << kDefaultMaskFile << " if it exists)\n"
+         << "  --detectors LIST   comma-separated APV ids of the detectors (default: all DUTs)\n"
+         << "  --threads N        number of threads, 0 for all cores (default 8)\n"
+         << "  --bootstrap R      bootstrap replicas for the uncertainties (default 0, off)\n"
+         << "  --cluster-gap N    missing strips allowed inside a cluster (default " << ClusterSettings().maxGap << ")\n"
+         << "  --cluster-threshold Q  minimum maxQ (ADC) of a clustered strip (default " << ClusterSettings().chargeThreshold << ")\n";
+}
+
+// Parses a comma-separated list of ids; returns false if it is malformed.
+bool parseIds(const string& list, vector<int>& ids)
+{
+    istringstream tokens(list);
+    string token;
+    while (getline(tokens, token, ',')) {
+        char* end = nullptr;
+        long id = strtol(token.c_str(), &end, 10);
+        if (token.empty() || *end != '\0' || id < 0) return false;
+        ids.push_back(id);
+    }
+    return !ids.empty();
+}
+
+bool parseUnsigned(const string& value, unsigned int& result)
+{
+    char* end = nullptr;
+    long n = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || n < 0) return false;
+    result = n;
+    return true;
+}
+
+bool parseFloat(const string& value, float& result)
+{
+    char* end = nullptr;
+    float x = strtof(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || !(x >= 0)) return false;
+    result = x;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    string command = argv[1];
+    string runFile = "Data/run6578.root";
+    AnalysisOptions options;
+
+    for (int i = 2; i < argc; ++i) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << option << endl;
+            usage();
+            return 1;
+        }
+        string value = argv[++i];
+
+        bool ok = true;
+        if (option == "--run") runFile = value;
+        else if (option == "--runs") options.runList = value;
+        else if (option == "--map") options.mapFile = value;
+        else if (option == "--geometry") options.geometryFile = value;
+        else if (option == "--mask") options.maskFile = value == "none" ? "" : value;
+        else if (option == "--detectors") ok = parseIds(value, options.detectors);
+        else if (option == "--threads") ok = parseUnsigned(value, options.threads);
+        else if (option == "--bootstrap") ok = parseUnsigned(value, options.bootstrapReplicas);
+        else if (option == "--cluster-gap") ok = parseUnsigned(value, options.clustering.maxGap);
+        else if (option == "--cluster-threshold") ok = parseFloat(value, options.clustering.chargeThreshold);
+        else {
+            cerr << "Unknown option: " << option << endl;
+            usage();
+            return 1;
+        }
+        if (!ok) {
+            cerr << "Invalid value for " << option << ": " << value << endl;
+            return 1;
+        }
+    }
+
+    // No canvases on screen, only the files.
+    gROOT->SetBatch(true);
+
+    if (command == "histograms") {
+        runHistograms(runFile, options);
+        return 0;
+    }
+    if (command == "efficiency") return runEfficiency(options);
+    if (command == "hvscan") {
+        runHVScan(options);
+        return 0;
+    }
+
+    cerr << "Unknown command: " << command << endl;
+    usage();
+    return 1;
+}
@@ -11,114 +11,59 @@
 #include <ROOT/TThreadExecutor.hxx> // Include for setting number of threads
 #include <TStyle.h>
 #include <TLegend.h>
+#include <TPaveStats.h>
+#include <TVirtualPad.h>
+#include "analysis.h"
 
 using namespace std;
 
-void histograms()
+// Draws one histogram per detector on a 2x3 grid and saves the canvas
+void drawPerDetector(map<int, TH1F*>& histograms, const vector<int>& ids, const vector<int>& colors,
+                     const char* name, const char* title, const char* outFile)
 {
+    TCanvas *canvas = new TCanvas(name, title, 1200, 1200);
+    canvas->Divide(2, 3);
 
-    // Enable multi-threading and set the number of threads
-    ROOT::EnableImplicitMT(8); // Replace 4 with the desired number of threads
-
-    // Open the ROOT file containing the tree.
-    TFile *file = TFile::Open("Data/run6578.root");
-    if (!file || file->IsZombie()) { // Check if the file is opened successfully.
-        cerr << "Error opening file or file not found." << endl;
-        return;
-    }
-
-    // Retrieve the tree named "raw" from the file.
-    TTree *tree = (TTree*)file->Get("raw");
-    if (!tree) { // Check if the tree exists.
-        cerr << "Tree 'raw' not found in file." << endl;
-        file->Close(); // Close the file if the tree is not found.
-        return; // Exit the function.
+    for (size_t i = 0; i < ids.size(); ++i) {
+        TH1F *h = histograms[ids[i]];
+        canvas->cd(i + 1);
+        h->SetLineColor(colors[i]);
+        float sizelabel = 0.035;
+        h->GetXaxis()->SetTitleSize(sizelabel);
+        h->GetXaxis()->SetLabelSize(sizelabel);
+        h->GetYaxis()->SetTitleSize(sizelabel);
+        h->GetYaxis()->SetLabelSize(sizelabel);
+        h->Draw();
+        gPad->SetGrid();
     }
 
-    // Create a data frame from the TTree for easier processing.
-    ROOT::RDataFrame df(*tree);
-
-    vector<int> ids = {8, 9, 10, 11, 12, 13};
-    map<int, string> idToName = {{8, "2"}, {9, "3"}, {10, "4"}, {11, "5"}, {12, "6"}, {13, "7"}};
-    
-    // Map to store a histogram for each detector ID
-    map<int, TH1I*> histogramsHits;
-    map<int, TH1F*> histogramsQ;
-    map<int, TH1F*> histogramsTQ;
-    
-    for (int id : ids) {
-        string name = idToName[id];
-        
-        histogramsHits[id] = new TH1I(Form("hCounts_%s", name.c_str()),
-                                      Form("Hits of Detector in plane %s per Event; Number of hits; Number of Events", name.c_str()),
-                                      150, 0, 150);
-
-        histogramsQ[id] = new TH1F(Form("hMaxQ_%s", name.c_str()),
-                                   Form("Charge of Detector %s;Charge (ADC);Number of Events", name.c_str()),
-                                   200, 0, 2000);
+    canvas->SaveAs(outFile);
+    delete canvas;
+}
 
-        histogramsTQ[id] = new TH1F(Form("hSumMaxCharge_%s", name.c_str()), 
-                                    Form("Total Charge for Detector %s;Charge;Number of Events", name.c_str()), 
-                                    200, 0, 4000);
-    }
+void runHistograms(const string& runFile, const AnalysisOptions& options)
+{
 
-    // Lambda function to check if detector with id 13 is activated in the event.
-    auto hasDetector13 = [](const vector<unsigned int>& ids) {
-        return find(ids.begin(), ids.end(), 13) != ids.end();
-    };
-
-    // Filter the data frame to include only those events where detector 13 is activated.
-    auto filtered = df.Filter(hasDetector13, {"apv_id"});
-
-    /**********/
-    /** Hits **/
-    /**********/
-    filtered.Foreach([&](const vector<unsigned int>& apv_id) {
-        map<int, int> hitsCount;
-        for (int id : ids) {
-            hitsCount[id] = count(apv_id.begin(), apv_id.end(), id);
-            // histogramsHits[id]->Fill(hitsCount[id]);
-            if (hitsCount[id] != 0 && hitsCount[id] <= 10){
-                histogramsHits[id]->Fill(hitsCount[id]);
-            }  
-        }
-    }, {"apv_id"});
+    // Enable multi-threading and set the number of threads
+    enableThreads(options);
 
-    /********************/
-    /** Charge Maximum **/
-    /********************/
-    filtered.Foreach([&](const vector<unsigned int>& apv_id, const vector<vector<short>>& apv_q) {
-        for (size_t i = 0; i < apv_id.size(); i++) {
-            int current_id = apv_id[i];
-            if (histogramsQ.count(current_id) > 0 && histogramsQ[current_id] != nullptr) {
-                short maxQ = *max_element(apv_q[i].begin(), apv_q[i].end());
-                histogramsQ[current_id]->Fill(maxQ);
-            }
-        }   
-    }, {"apv_id", "apv_q"});
-
-    /************************/
-    /** Maximum Charge Sum **/
-    /************************/
-    filtered.Foreach([&](const vector<unsigned int>& apv_id, const vector<vector<short>>& apv_q) {
-        map<int, double> sumMaxCharges; // Map to store the sum of max charges for each ID in this event
-
-        for (size_t i = 0; i < apv_id.size(); ++i) {
-            int current_id = apv_id[i];
-            if (histogramsTQ.find(current_id) != histogramsTQ.end()) { // Check if we have a histogram for this ID
-                const auto& charges = apv_q[i];
-                if (!charges.empty()) {
-                    short maxCharge = *max_element(charges.begin(), charges.end());
-                    sumMaxCharges[current_id] += maxCharge; // Add max charge to sum for this detector
-                }
-            }
-        }
+    // Detectors to analyse, from the mapping file.
+    DetectorSetup setup = loadDetectorSetup(options);
+    if (!setup.mapping) return;
+    vector<int>& ids = setup.ids;
+    map<int, string>& idToName = setup.idToName;
+    
+    /**********************/
+    /** Hits and Charges **/
+    /**********************/
+    // All three histogram families are filled in one event loop, only over the events where
+    // the trigger detector (13) is activated. The run is read from its hit cache if there is one.
+    HitHistograms result = processRuns({runFile}, setup)[0];
+    if (result.hits.empty()) return;
 
-        // Fill histograms with the sum of maximum charges for each relevant detector
-        for (const auto& sum : sumMaxCharges) {
-            histogramsTQ[sum.first]->Fill(sum.second);
-        }
-    }, {"apv_id", "apv_q"});
+    map<int, TH1I*>& histogramsHits = result.hits;
+    map<int, TH1F*>& histogramsQ = result.maxQ;
+    map<int, TH1F*>& histogramsTQ = result.totalQ;
 
 
     /****************/
@@ -334,9 +279,26 @@ void histograms()
 
 
 
+    /*****************************/
+    /** Cluster charge/centroid **/
+    /*****************************/
+
+    // Total charge and centroid of every cluster, with the clustering settings of the options
+    drawPerDetector(result.clusterCharge, ids, colors, "canvasClusterQ", "Cluster Charge for Different Detectors",
+                    "Figures/histograms_cluster_charge.png");
+    drawPerDetector(result.clusterCentroid, ids, colors, "canvasCentroid", "Cluster Centroid for Different Detectors",
+                    "Figures/histograms_cluster_centroid.png");
+
+    cout << "Clusters (gap " << setup.clustering.maxGap << ", threshold " << setup.clustering.chargeThreshold << " ADC)" << endl;
+    for (int id : ids) {
+        cout << "Detector " << idToName[id] << "  clusters " << result.clusterCharge[id]->GetEntries()
+             << "  mean charge " << result.clusterCharge[id]->GetMean()
+             << "  mean centroid " << result.clusterCentroid[id]->GetMean()
+             << "  leading cluster size " << result.clusterSize[id]->GetMean() << endl;
+    }
+
+
     // Clean up
-    file->Close();
-    delete file;
     delete canvasHits;
     delete logcanvasHits;
     delete canvasQ;
@@ -346,3 +308,8 @@ void histograms()
     // for (auto& hist : histogramsQ) delete hist.second;
     // for (auto& hist : histogramsTQ) delete hist.second;
 }
+
+void histograms()
+{
+    runHistograms("Data/run6578.root", AnalysisOptions());
+}
@@ -0,0 +1,367 @@
+#ifndef HIT_CACHE_H
+#define HIT_CACHE_H
+
+// Columnar per-hit cache of a raw run.
+//
+// The raw tree stores apv_q as vector<vector<short>>, one heap allocation per hit and
+// event, although the analyses only use a few numbers per hit. convertHits.C reads a run
+// once and writes Data/runNNNN.hits next to it, a flat binary file laid out as
+//
+//   HitCacheHeader
+//   uint32  apv_evt[nEvents]
+//   uint64  offsets[nEvents + 1]   hits of event i are [offsets[i], offsets[i + 1])
+//   uint16  apv_id[nHits]
+//   uint16  apv_ch[nHits]
+//   uint16  strip[nHits]           strip number from the mapping file
+//   uint8   chamber[nHits]         Chamber from the mapping file, kNoChamber if not mapped
+//   int16   maxQ[nHits]            pedestal-subtracted maximum of the time samples
+//   uint8   peak_bin[nHits]        time sample of the maximum
+//   float   integral[nHits]        pedestal-subtracted sum of the samples after the presamples
+//
+// with every array starting on an 8-byte boundary. HitCacheReader maps the file into
+// memory, so reading an event is pointer arithmetic with no decompression or allocation.
+// maxQ, peak_bin and integral are computed by apvSignal() (apvSignal.h). Hits of channels
+// masked at conversion time are not stored. The header records the fingerprint of the mapping
+// and the checksum of the mask used, as strip and chamber are resolved at conversion time.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "apvMapping.h"
+#include "apvSignal.h"
+#include "channelMask.h"
+
+// Per-hit arrays of one event, either decoded from the raw tree or pointing into a hit cache.
+struct EventHits {
+    size_t n = 0;
+    const uint16_t* apvId = nullptr;
+    const uint16_t* apvCh = nullptr;
+    const uint16_t* strip = nullptr;
+    const uint8_t* chamber = nullptr;
+    const int16_t* maxQ = nullptr;
+    const uint8_t* peakBin = nullptr;
+    const float* integral = nullptr;
+};
+
+inline bool hasApv(const EventHits& hits, unsigned int id)
+{
+    return std::find(hits.apvId, hits.apvId + hits.n, id) != hits.apvId + hits.n;
+}
+
+// Decodes the raw columns of one event into EventHits. Hits of the channels in the mask, if
+// any, are dropped. Chamber and strip of every hit are looked up in the mapping; the time
+// samples of all hits are copied into one sample-major block and processed together by
+// apvSignal(). The buffers are kept between events, so after the first few events decoding
+// does not allocate. One decoder per slot.
+class HitDecoder {
+public:
+    explicit HitDecoder(std::shared_ptr<const ApvMapping> mapping, std::shared_ptr<const ChannelMask> mask = nullptr)
+        : fMapping(mapping), fMask(mask)
+    {
+    }
+
+    EventHits Decode(const std::vector<unsigned int>& apv_id, const std::vector<unsigned int>& apv_ch,
+                     const std::vector<std::vector<short>>& apv_q, unsigned int apv_presamples)
+    {
+        fKept.clear();
+        for (size_t i = 0; i < apv_id.size(); ++i) {
+            if (!fMask || !fMask->IsMasked(apv_id[i], apv_ch[i])) fKept.push_back(i);
+        }
+
+        size_t n = fKept.size();
+        fApvId.resize(n);
+        fApvCh.resize(n);
+        fStrip.resize(n);
+        fChamber.resize(n);
+        fMaxQ.resize(n);
+        fPeakBin.resize(n);
+        fPedestal.resize(n);
+        fIntegral.resize(n);
+
+        size_t nSamples = 0;
+        for (size_t i = 0; i < n; ++i) {
+            size_t k = fKept[i];
+            fApvId[i] = apv_id[k];
+            fApvCh[i] = apv_ch[k];
+            fStrip[i] = fMapping->GetStrip(apv_id[k], apv_ch[k]);
+            fChamber[i] = fMapping->GetChamber(apv_id[k], apv_ch[k]);
+            nSamples = std::max(nSamples, apv_q[k].size());
+        }
+
+        // All hits of a run normally have the same number of time samples. A shorter hit is
+        // padded with its first sample, i.e. roughly its pedestal; a hit without samples is all zeros.
+        fSamples.resize(nSamples * n);
+        for (size_t i = 0; i < n; ++i) {
+            const std::vector<short>& charges = apv_q[fKept[i]];
+            for (size_t t = 0; t < nSamples; ++t) {
+                fSamples[t * n + i] = t < charges.size() ? charges[t] : (charges.empty() ? 0 : charges[0]);
+            }
+        }
+
+        ApvSignalOutput out = {fMaxQ.data(), fPeakBin.data(), fPedestal.data(), fIntegral.data()};
+        apvSignal(fSamples.data(), n, n, nSamples, apv_presamples, out);
+
+        EventHits hits;
+        hits.n = n;
+        hits.apvId = fApvId.data();
+        hits.apvCh = fApvCh.data();
+        hits.strip = fStrip.data();
+        hits.chamber = fChamber.data();
+        hits.maxQ = fMaxQ.data();
+        hits.peakBin = fPeakBin.data();
+        hits.integral = fIntegral.data();
+        return hits;
+    }
+
+private:
+    std::shared_ptr<const ApvMapping> fMapping;
+    std::shared_ptr<const ChannelMask> fMask;
+    std::vector<size_t> fKept; // indices of the hits that are not masked
+    std::vector<uint16_t> fApvId;
+    std::vector<uint16_t> fApvCh;
+    std::vector<uint16_t> fStrip;
+    std::vector<uint8_t> fChamber;
+    std::vector<int16_t> fMaxQ;
+    std::vector<uint8_t> fPeakBin;
+    std::vector<float> fPedestal;
+    std::vector<float> fIntegral;
+    std::vector<int16_t> fSamples;
+};
+
+struct HitCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t maskChecksum;       // channelMaskChecksum() of the mask applied when converting, 0 for none
+    uint64_t mappingFingerprint; // mappingFingerprint() of the mapping used when converting
+    uint64_t nEvents;
+    uint64_t nHits;
+};
+
+const char kHitCacheMagic[8] = {'G', 'R', 'A', 'L', 'H', 'I', 'T', 'S'};
+const uint32_t kHitCacheVersion = 4;
+
+// Byte offsets of the arrays in a hit cache file.
+struct HitCacheLayout {
+    uint64_t eventNumber, offsets, apvId, apvCh, strip, chamber, maxQ, peakBin, integral, size;
+
+    HitCacheLayout(uint64_t nEvents, uint64_t nHits)
+    {
+        auto align = [](uint64_t pos) { return (pos + 7) & ~uint64_t(7); };
+        eventNumber = align(sizeof(HitCacheHeader));
+        offsets = align(eventNumber + nEvents * sizeof(uint32_t));
+        apvId = align(offsets + (nEvents + 1) * sizeof(uint64_t));
+        apvCh = align(apvId + nHits * sizeof(uint16_t));
+        strip = align(apvCh + nHits * sizeof(uint16_t));
+        chamber = align(strip + nHits * sizeof(uint16_t));
+        maxQ = align(chamber + nHits * sizeof(uint8_t));
+        peakBin = align(maxQ + nHits * sizeof(int16_t));
+        integral = align(peakBin + nHits * sizeof(uint8_t));
+        size = integral + nHits * sizeof(float);
+    }
+};
+
+// Hit cache file belonging to a raw run file: Data/run6586.root -> Data/run6586.hits.
+inline std::string hitCachePath(const std::string& rootFile)
+{
+    size_t dot = rootFile.rfind(".root");
+    return (dot == std::string::npos ? rootFile : rootFile.substr(0, dot)) + ".hits";
+}
+
+// True if the hit cache of a run exists and is not older than the run file.
+inline bool isHitCacheCurrent(const std::string& rootFile)
+{
+    struct stat raw, cache;
+    if (stat(hitCachePath(rootFile).c_str(), &cache) != 0) return false;
+    if (stat(rootFile.c_str(), &raw) != 0) return true;
+    return cache.st_mtime >= raw.st_mtime;
+}
+
+// Collects events in memory and writes them as a hit cache file.
+class HitCacheWriter {
+public:
+    HitCacheWriter() : fOffsets(1, 0) {}
+
+    void AddEvent(unsigned int eventNumber, const EventHits& hits)
+    {
+        fEventNumber.push_back(eventNumber);
+        fApvId.insert(fApvId.end(), hits.apvId, hits.apvId + hits.n);
+        fApvCh.insert(fApvCh.end(), hits.apvCh, hits.apvCh + hits.n);
+        fStrip.insert(fStrip.end(), hits.strip, hits.strip + hits.n);
+        fChamber.insert(fChamber.end(), hits.chamber, hits.chamber + hits.n);
+        fMaxQ.insert(fMaxQ.end(), hits.maxQ, hits.maxQ + hits.n);
+        fPeakBin.insert(fPeakBin.end(), hits.peakBin, hits.peakBin + hits.n);
+        fIntegral.insert(fIntegral.end(), hits.integral, hits.integral + hits.n);
+        fOffsets.push_back(fApvId.size());
+    }
+
+    bool Write(const std::string& path, uint64_t mappingFingerprint, uint32_t maskChecksum) const
+    {
+        HitCacheHeader header;
+        std::memcpy(header.magic, kHitCacheMagic, sizeof(header.magic));
+        header.version = kHitCacheVersion;
+        header.maskChecksum = maskChecksum;
+        header.mappingFingerprint = mappingFingerprint;
+        header.nEvents = fEventNumber.size();
+        header.nHits = fApvId.size();
+        HitCacheLayout layout(header.nEvents, header.nHits);
+
+        FILE* out = std::fopen(path.c_str(), "wb");
+        if (!out) return false;
+
+        bool ok = WriteAt(out, 0, &header, sizeof(header));
+        ok = ok && WriteAt(out, layout.eventNumber, fEventNumber.data(), fEventNumber.size() * sizeof(uint32_t));
+        ok = ok && WriteAt(out, layout.offsets, fOffsets.data(), fOffsets.size() * sizeof(uint64_t));
+        ok = ok && WriteAt(out, layout.apvId, fApvId.data(), fApvId.size() * sizeof(uint16_t));
+        ok = ok && WriteAt(out, layout.apvCh, fApvCh.data(), fApvCh.size() * sizeof(uint16_t));
+        ok = ok && WriteAt(out, layout.strip, fStrip.data(), fStrip.size() * sizeof(uint16_t));
+        ok = ok && WriteAt(out, layout.chamber, fChamber.data(), fChamber.size() * sizeof(uint8_t));
+        ok = ok && WriteAt(out, layout.maxQ, fMaxQ.data(), fMaxQ.size() * sizeof(int16_t));
+        ok = ok && WriteAt(out, layout.peakBin, fPeakBin.data(), fPeakBin.size() * sizeof(uint8_t));
+        ok = ok && WriteAt(out, layout.integral, fIntegral.data(), fIntegral.size() * sizeof(float));
+        ok = std::fclose(out) == 0 && ok;
+        if (!ok) std::remove(path.c_str());
+        return ok;
+    }
+
+private:
+    // Writes an array at byte offset pos, zero-padding from the end of the previous one.
+    static bool WriteAt(FILE* out, uint64_t pos, const void* data, size_t size)
+    {
+        const char zeros[8] = {};
+        long end = std::ftell(out);
+        if (end < 0 || (uint64_t)end > pos || pos - end > sizeof(zeros)) return false;
+        if (pos > (uint64_t)end && std::fwrite(zeros, pos - end, 1, out) != 1) return false;
+        return size == 0 || std::fwrite(data, size, 1, out) == 1;
+    }
+
+    std::vector<uint32_t> fEventNumber;
+    std::vector<uint64_t> fOffsets;
+    std::vector<uint16_t> fApvId;
+    std::vector<uint16_t> fApvCh;
+    std::vector<uint16_t> fStrip;
+    std::vector<uint8_t> fChamber;
+    std::vector<int16_t> fMaxQ;
+    std::vector<uint8_t> fPeakBin;
+    std::vector<float> fIntegral;
+};
+
+// Read-only, memory-mapped view of a hit cache file. Safe to read from several threads.
+class HitCacheReader {
+public:
+    explicit HitCacheReader(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(HitCacheHeader)) {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                fData = static_cast<const char*>(data);
+                fSize = st.st_size;
+            }
+        }
+        close(fd);
+        if (!fData) return;
+
+        const HitCacheHeader* header = reinterpret_cast<const HitCacheHeader*>(fData);
+        if (std::memcmp(header->magic, kHitCacheMagic, sizeof(header->magic)) != 0 ||
+            header->version != kHitCacheVersion) return;
+
+        HitCacheLayout layout(header->nEvents, header->nHits);
+        if (layout.size > fSize) return;
+
+        fEntries = header->nEvents;
+        fMaskChecksum = header->maskChecksum;
+        fMappingFingerprint = header->mappingFingerprint;
+        fEventNumber = reinterpret_cast<const uint32_t*>(fData + layout.eventNumber);
+        fOffsets = reinterpret_cast<const uint64_t*>(fData + layout.offsets);
+        fApvId = reinterpret_cast<const uint16_t*>(fData + layout.apvId);
+        fApvCh = reinterpret_cast<const uint16_t*>(fData + layout.apvCh);
+        fStrip = reinterpret_cast<const uint16_t*>(fData + layout.strip);
+        fChamber = reinterpret_cast<const uint8_t*>(fData + layout.chamber);
+        fMaxQ = reinterpret_cast<const int16_t*>(fData + layout.maxQ);
+        fPeakBin = reinterpret_cast<const uint8_t*>(fData + layout.peakBin);
+        fIntegral = reinterpret_cast<const float*>(fData + layout.integral);
+        fValid = true;
+    }
+
+    ~HitCacheReader()
+    {
+        if (fData) munmap(const_cast<char*>(fData), fSize);
+    }
+
+    HitCacheReader(const HitCacheReader&) = delete;
+    HitCacheReader& operator=(const HitCacheReader&) = delete;
+
+    bool IsValid() const { return fValid; }
+    uint64_t GetEntries() const { return fEntries; }
+    uint32_t GetMaskChecksum() const { return fMaskChecksum; }
+    uint64_t GetMappingFingerprint() const { return fMappingFingerprint; }
+    unsigned int EventNumber(uint64_t entry) const { return fEventNumber[entry]; }
+
+    EventHits Event(uint64_t entry) const
+    {
+        uint64_t begin = fOffsets[entry];
+        EventHits hits;
+        hits.n = fOffsets[entry + 1] - begin;
+        hits.apvId = fApvId + begin;
+        hits.apvCh = fApvCh + begin;
+        hits.strip = fStrip + begin;
+        hits.chamber = fChamber + begin;
+        hits.maxQ = fMaxQ + begin;
+        hits.peakBin = fPeakBin + begin;
+        hits.integral = fIntegral + begin;
+        return hits;
+    }
+
+private:
+    const char* fData = nullptr;
+    uint64_t fSize = 0;
+    bool fValid = false;
+    uint64_t fEntries = 0;
+    uint32_t fMaskChecksum = 0;
+    uint64_t fMappingFingerprint = 0;
+    const uint32_t* fEventNumber = nullptr;
+    const uint64_t* fOffsets = nullptr;
+    const uint16_t* fApvId = nullptr;
+    const uint16_t* fApvCh = nullptr;
+    const uint16_t* fStrip = nullptr;
+    const uint8_t* fChamber = nullptr;
+    const int16_t* fMaxQ = nullptr;
+    const uint8_t* fPeakBin = nullptr;
+    const float* fIntegral = nullptr;
+};
+
+// Calls f(slot, entry, hits) for every event of a hit cache, using nSlots threads.
+// Events are handed out in chunks, so per-slot state in f needs no locking.
+template <typename F>
+void forEachCachedEvent(const HitCacheReader& cache, unsigned int nSlots, F&& f)
+{
+    const uint64_t chunk = 4096;
+    const uint64_t entries = cache.GetEntries();
+    std::atomic<uint64_t> next(0);
+
+    auto work = [&](unsigned int slot) {
+        for (uint64_t begin = next.fetch_add(chunk); begin < entries; begin = next.fetch_add(chunk)) {
+            uint64_t end = std::min(begin + chunk, entries);
+            for (uint64_t entry = begin; entry < end; ++entry) f(slot, entry, cache.Event(entry));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int slot = 1; slot < nSlots; ++slot) threads.emplace_back(work, slot);
+    work(0);
+    for (std::thread& t : threads) t.join();
+}
+
+#endif
@@ -0,0 +1,341 @@
+#ifndef HIT_HISTOGRAMS_H
+#define HIT_HISTOGRAMS_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ROOT/RDataFrame.hxx>
+#include <RtypesCore.h>
+#include <TH1F.h>
+#include <TH1I.h>
+#include "bootstrap.h"
+#include "detectorSetup.h"
+#include "hitCache.h"
+#include "stripClustering.h"
+#include "telescopeTracking.h"
+
+// Books a helper whose Exec() takes the raw hit columns decoded by HitDecoder.
+template <typename Helper>
+ROOT::RDF::RResultPtr<typename Helper::Result_t> bookOnRawHits(ROOT::RDF::RNode node, Helper&& helper)
+{
+    return node.Book<std::vector<unsigned int>, std::vector<unsigned int>, std::vector<std::vector<short>>, unsigned int>(
+        std::move(helper), {"apv_id", "apv_ch", "apv_q", "apv_presamples"});
+}
+
+// Binning of the HitHistograms; part of the result cache key (see resultCache.h).
+struct HistogramBinning {
+    int bins;
+    double min;
+    double max;
+};
+
+const HistogramBinning kHitsBinning = {150, 0, 150};
+const HistogramBinning kMaxQBinning = {200, 0, 2000};
+const HistogramBinning kTotalQBinning = {200, 0, 4000};
+const HistogramBinning kClustersBinning = {20, 0, 20};
+const HistogramBinning kClusterSizeBinning = {50, 0, 50};
+const HistogramBinning kClusterChargeBinning = {200, 0, 4000};
+const HistogramBinning kCentroidBinning = {kClusterStrips, 0, kClusterStrips};
+
+// Increase whenever the selection or the filling of HitHistograms changes, so cached results
+// of the previous version are not used any more.
+const int kHitHistogramsVersion = 4;
+
+// Per-detector histograms of one run: hits per event, maximum charge of every hit,
+// sum of the maximum charges per event, strip clusters per event, size of the leading
+// (highest charge) cluster, and total charge and centroid of every cluster. All of these
+// are filled only for events in which the
+// trigger detector fired. Also counts these events and, per detector, the events in which
+// it fired, which is all computeEfficiency() needs, and, over all events, the telescope
+// tracks in the acceptance of the detector and those matched by one of its clusters (see
+// telescopeTracking.h).
+// Also the unbinned efficiencies and means of every detector with their standard errors and, with
+// bootstrap replicas enabled in the DetectorSetup, their bootstrap samples (see bootstrap.h).
+struct HitHistograms {
+    std::map<int, TH1I*> hits;
+    std::map<int, TH1F*> maxQ;
+    std::map<int, TH1F*> totalQ;
+    std::map<int, TH1I*> clusters;
+    std::map<int, TH1I*> clusterSize;
+    std::map<int, TH1F*> clusterCharge;
+    std::map<int, TH1F*> clusterCentroid;
+    std::map<int, ULong64_t> fired;
+    ULong64_t events = 0;
+    std::map<int, ULong64_t> tracks;
+    std::map<int, ULong64_t> matched;
+    std::map<int, double> residualMean; // of the matched tracks
+    std::map<int, double> residualRms;
+    std::map<int, BootstrapSamples> bootstrap;
+};
+
+// RDataFrame action filling HitHistograms in a single pass over the raw hit columns.
+// TH1::Fill is not thread-safe, so every processing slot fills its own copy of the
+// histograms and the copies are added to the booked ones in Finalize().
+//
+// All events are passed to the helper: the tracking uses every event, and the histograms select
+// the events in which the trigger detector fired themselves.
+//
+// Usage:
+//   ROOT::RDataFrame df("raw", file);
+//   auto result = bookOnRawHits(df, HitHistogramsHelper(setup, df.GetNSlots()));
+class HitHistogramsHelper : public ROOT::Detail::RDF::RActionImpl<HitHistogramsHelper> {
+public:
+    using Result_t = HitHistograms;
+
+    HitHistogramsHelper(const DetectorSetup& setup, unsigned int nSlots, const std::string& suffix = "")
+        : fIds(setup.ids), fResult(std::make_shared<HitHistograms>()), fSlots(nSlots),
+          fDecoders(nSlots, HitDecoder(setup.mapping, setup.mask)), fClusterers(nSlots, StripClusterer(setup.clustering)),
+          fTrackers(nSlots, TrackFitter(setup.tracking)), fTrigger(setup.triggerId),
+          fSlotHits(nSlots, std::vector<int>(fIds.size())),
+          fSlotSumQ(nSlots, std::vector<double>(fIds.size())),
+          fSlotFired(nSlots, std::vector<ULong64_t>(fIds.size())),
+          fSlotEvents(nSlots), fSlotSums(nSlots, std::vector<double>(fIds.size() * kNumBootstrapSums)),
+          fSlotTracking(nSlots), fTrackSums(setup.bootstrapReplicas > 0)
+    {
+        for (unsigned int slot = 0; slot < nSlots; ++slot) {
+            fBootstrap.emplace_back(fIds.size(), setup.bootstrapReplicas, slot + 1);
+        }
+
+        const std::vector<int>& ids = fIds;
+        int maxId = ids.empty() ? 0 : *std::max_element(ids.begin(), ids.end());
+        fIndex.assign(maxId + 1, -1);
+
+        for (size_t d = 0; d < ids.size(); ++d) {
+            int id = ids[d];
+            fIndex[id] = d;
+            fChambers.push_back(setup.mapping->GetApvChamber(id));
+            const char* name = setup.idToName.at(id).c_str();
+
+            fResult->hits[id] = new TH1I(Form("hCounts_%s%s", name, suffix.c_str()),
+                                         Form("Hits of Detector in plane %s per Event; Number of hits; Number of Events", name),
+                                         kHitsBinning.bins, kHitsBinning.min, kHitsBinning.max);
+
+            fResult->maxQ[id] = new TH1F(Form("hMaxQ_%s%s", name, suffix.c_str()),
+                                         Form("Charge of Detector %s;Charge (ADC);Number of Events", name),
+                                         kMaxQBinning.bins, kMaxQBinning.min, kMaxQBinning.max);
+
+            fResult->totalQ[id] = new TH1F(Form("hSumMaxCharge_%s%s", name, suffix.c_str()),
+                                           Form("Total Charge for Detector %s;Charge;Number of Events", name),
+                                           kTotalQBinning.bins, kTotalQBinning.min, kTotalQBinning.max);
+
+            fResult->clusters[id] = new TH1I(Form("hClusters_%s%s", name, suffix.c_str()),
+                                             Form("Clusters of Detector %s per Event;Number of clusters;Number of Events", name),
+                                             kClustersBinning.bins, kClustersBinning.min, kClustersBinning.max);
+
+            fResult->clusterSize[id] = new TH1I(Form("hClusterSize_%s%s", name, suffix.c_str()),
+                                                Form("Cluster size of Detector %s;Strips in leading cluster;Number of Events", name),
+                                                kClusterSizeBinning.bins, kClusterSizeBinning.min, kClusterSizeBinning.max);
+
+            fResult->clusterCharge[id] = new TH1F(Form("hClusterCharge_%s%s", name, suffix.c_str()),
+                                                  Form("Cluster charge of Detector %s;Sum of maxQ of the cluster (ADC);Number of Clusters", name),
+                                                  kClusterChargeBinning.bins, kClusterChargeBinning.min, kClusterChargeBinning.max);
+
+            fResult->clusterCentroid[id] = new TH1F(Form("hClusterCentroid_%s%s", name, suffix.c_str()),
+                                                    Form("Cluster centroid of Detector %s;Centroid (strip);Number of Clusters", name),
+                                                    kCentroidBinning.bins, kCentroidBinning.min, kCentroidBinning.max);
+        }
+
+        // Slot 0 fills the booked histograms directly, the other slots fill detached clones.
+        fSlots[0] = *fResult;
+        for (unsigned int slot = 1; slot < nSlots; ++slot) {
+            for (int id : ids) {
+                fSlots[slot].hits[id] = CloneForSlot(fResult->hits[id], slot);
+                fSlots[slot].maxQ[id] = CloneForSlot(fResult->maxQ[id], slot);
+                fSlots[slot].totalQ[id] = CloneForSlot(fResult->totalQ[id], slot);
+                fSlots[slot].clusters[id] = CloneForSlot(fResult->clusters[id], slot);
+                fSlots[slot].clusterSize[id] = CloneForSlot(fResult->clusterSize[id], slot);
+                fSlots[slot].clusterCharge[id] = CloneForSlot(fResult->clusterCharge[id], slot);
+                fSlots[slot].clusterCentroid[id] = CloneForSlot(fResult->clusterCentroid[id], slot);
+            }
+        }
+    }
+
+    HitHistogramsHelper(HitHistogramsHelper&&) = default;
+    HitHistogramsHelper(const HitHistogramsHelper&) = delete;
+
+    std::shared_ptr<HitHistograms> GetResultPtr() const { return fResult; }
+
+    void Initialize() {}
+    void InitTask(TTreeReader*, unsigned int) {}
+
+    void Exec(unsigned int slot, const std::vector<unsigned int>& apv_id, const std::vector<unsigned int>& apv_ch,
+              const std::vector<std::vector<short>>& apv_q, unsigned int apv_presamples)
+    {
+        Fill(slot, fDecoders[slot].Decode(apv_id, apv_ch, apv_q, apv_presamples));
+    }
+
+    // Fused per-event kernel, also used directly when the events come from a hit cache.
+    void Fill(unsigned int slot, const EventHits& event)
+    {
+        std::vector<int>& nHits = fSlotHits[slot];
+        std::vector<double>& sumQ = fSlotSumQ[slot];
+        std::fill(nHits.begin(), nHits.end(), 0);
+        std::fill(sumQ.begin(), sumQ.end(), 0.);
+
+        StripClusterer& clusterer = fClusterers[slot];
+        clusterer.Process(event);
+        // With replicas the track of the event is fitted at once, so that its counts get the
+        // bootstrap weights of the event.
+        bool track = fTrackers[slot].Add(clusterer) && fTrackSums;
+        if (track) fTrackers[slot].Flush();
+
+        bool triggered = hasApv(event, fTrigger);
+        if (triggered) FillHistograms(slot, event, clusterer);
+        if (triggered || track) FillSums(slot, triggered, track, clusterer);
+    }
+
+    // Sets the counts of the result to those of the events filled so far. With a single slot the
+    // histograms are filled in place, so the result is then complete without ending the pass;
+    // this is what the online monitor uses for its snapshots.
+    void Update()
+    {
+        TrackingCounts tracking;
+        fResult->events = 0;
+        for (size_t d = 0; d < fIds.size(); ++d) fResult->fired[fIds[d]] = 0;
+        for (unsigned int slot = 0; slot < fTrackers.size(); ++slot) {
+            fResult->events += fSlotEvents[slot];
+            for (size_t d = 0; d < fIds.size(); ++d) fResult->fired[fIds[d]] += fSlotFired[slot][d];
+            fTrackers[slot].Flush();
+            tracking.Add(fTrackers[slot].GetCounts());
+        }
+
+        for (size_t d = 0; d < fIds.size(); ++d) {
+            int dut = fChambers[d] - kDut01;
+            if (dut < 0 || dut >= kNumDuts) continue;
+            fResult->tracks[fIds[d]] = tracking.tracks[dut];
+            fResult->matched[fIds[d]] = tracking.matched[dut];
+            double mean = tracking.matched[dut] > 0 ? tracking.residualSum[dut] / tracking.matched[dut] : 0.;
+            double mean2 = tracking.matched[dut] > 0 ? tracking.residualSum2[dut] / tracking.matched[dut] : 0.;
+            fResult->residualMean[fIds[d]] = mean;
+            fResult->residualRms[fIds[d]] = std::sqrt(std::max(mean2 - mean * mean, 0.));
+        }
+
+        BootstrapAccumulator bootstrap = fBootstrap[0];
+        for (unsigned int slot = 1; slot < fBootstrap.size(); ++slot) bootstrap.Merge(fBootstrap[slot]);
+        for (size_t d = 0; d < fIds.size(); ++d) fResult->bootstrap[fIds[d]] = bootstrap.GetSamples(d);
+    }
+
+    void Finalize()
+    {
+        Update();
+
+        for (unsigned int slot = 1; slot < fSlots.size(); ++slot) {
+            for (int id : fIds) {
+                fResult->hits[id]->Add(fSlots[slot].hits[id]);
+                fResult->maxQ[id]->Add(fSlots[slot].maxQ[id]);
+                fResult->totalQ[id]->Add(fSlots[slot].totalQ[id]);
+                fResult->clusters[id]->Add(fSlots[slot].clusters[id]);
+                fResult->clusterSize[id]->Add(fSlots[slot].clusterSize[id]);
+                fResult->clusterCharge[id]->Add(fSlots[slot].clusterCharge[id]);
+                fResult->clusterCentroid[id]->Add(fSlots[slot].clusterCentroid[id]);
+                delete fSlots[slot].hits[id];
+                delete fSlots[slot].maxQ[id];
+                delete fSlots[slot].totalQ[id];
+                delete fSlots[slot].clusters[id];
+                delete fSlots[slot].clusterSize[id];
+                delete fSlots[slot].clusterCharge[id];
+                delete fSlots[slot].clusterCentroid[id];
+            }
+        }
+        fSlots.resize(1);
+    }
+
+    std::string GetActionName() { return "HitHistograms"; }
+
+private:
+    // Histograms and counts of an event in which the trigger fired.
+    void FillHistograms(unsigned int slot, const EventHits& event, const StripClusterer& clusterer)
+    {
+        std::vector<int>& nHits = fSlotHits[slot];
+        std::vector<double>& sumQ = fSlotSumQ[slot];
+        HitHistograms& h = fSlots[slot];
+
+        for (size_t i = 0; i < event.n; ++i) {
+            if (event.apvId[i] >= fIndex.size() || fIndex[event.apvId[i]] < 0) continue;
+            int d = fIndex[event.apvId[i]];
+
+            nHits[d]++;
+            h.maxQ[fIds[d]]->Fill(event.maxQ[i]);
+            sumQ[d] += event.maxQ[i];
+        }
+
+        fSlotEvents[slot]++;
+        for (size_t d = 0; d < fIds.size(); ++d) {
+            if (nHits[d] == 0) continue;
+            fSlotFired[slot][d]++;
+            if (nHits[d] <= 10) h.hits[fIds[d]]->Fill(nHits[d]);
+            h.totalQ[fIds[d]]->Fill(sumQ[d]);
+
+            unsigned int nClusters = clusterer.GetCount(fChambers[d]);
+            const StripCluster* clusters = clusterer.GetClusters(fChambers[d]);
+            h.clusters[fIds[d]]->Fill(nClusters);
+            for (unsigned int k = 0; k < nClusters; ++k) {
+                h.clusterCharge[fIds[d]]->Fill(clusters[k].charge);
+                h.clusterCentroid[fIds[d]]->Fill(clusters[k].centroid);
+            }
+            const StripCluster* leading = clusterer.GetLeading(fChambers[d]);
+            if (leading) h.clusterSize[fIds[d]]->Fill(leading->size);
+        }
+    }
+
+    // Bootstrap sums of an event in which the trigger fired or, with replicas, that has a track.
+    void FillSums(unsigned int slot, bool triggered, bool track, const StripClusterer& clusterer)
+    {
+        const std::vector<int>& nHits = fSlotHits[slot];
+        const std::vector<double>& sumQ = fSlotSumQ[slot];
+        const TrackingCounts& counts = fTrackers[slot].GetCounts();
+        TrackingCounts& before = fSlotTracking[slot];
+
+        double* sums = fSlotSums[slot].data();
+        for (size_t d = 0; d < fIds.size(); ++d) {
+            const StripCluster* leading = nHits[d] > 0 ? clusterer.GetLeading(fChambers[d]) : nullptr;
+            double size = leading ? leading->size : 0;
+            int dut = fChambers[d] - kDut01;
+            bool isDut = track && dut >= 0 && dut < kNumDuts;
+            double* s = sums + d * kNumBootstrapSums;
+            s[kSumTriggered] = triggered;
+            s[kSumFired] = nHits[d] > 0;
+            s[kSumHits] = nHits[d];
+            s[kSumCharge] = sumQ[d];
+            s[kSumCharge2] = sumQ[d] * sumQ[d];
+            s[kSumClusterSize] = size;
+            s[kSumClusterSize2] = size * size;
+            s[kSumClustered] = leading != nullptr;
+            s[kSumTracks] = isDut ? counts.tracks[dut] - before.tracks[dut] : 0;
+            s[kSumMatched] = isDut ? counts.matched[dut] - before.matched[dut] : 0;
+        }
+        if (track) before = counts;
+        fBootstrap[slot].Add(sums);
+    }
+
+    template <typename T>
+    static T* CloneForSlot(T* h, unsigned int slot)
+    {
+        T* clone = static_cast<T*>(h->Clone(Form("%s_slot%u", h->GetName(), slot)));
+        clone->SetDirectory(nullptr);
+        return clone;
+    }
+
+    std::vector<int> fIds;
+    std::vector<int> fIndex; // apv_id -> position in fIds, -1 if not analysed
+    std::vector<Chamber> fChambers;
+    std::shared_ptr<HitHistograms> fResult;
+    std::vector<HitHistograms> fSlots;
+    std::vector<HitDecoder> fDecoders;
+    std::vector<StripClusterer> fClusterers;
+    std::vector<TrackFitter> fTrackers;
+    unsigned int fTrigger;
+    std::vector<std::vector<int>> fSlotHits;
+    std::vector<std::vector<double>> fSlotSumQ;
+    std::vector<std::vector<ULong64_t>> fSlotFired;
+    std::vector<ULong64_t> fSlotEvents;
+    std::vector<std::vector<double>> fSlotSums;  // per-event bootstrap sums
+    std::vector<TrackingCounts> fSlotTracking;    // tracking counts before the current event
+    std::vector<BootstrapAccumulator> fBootstrap;
+    bool fTrackSums; // whether the tracking counts enter the bootstrap sums (with replicas only)
+};
+
+#endif
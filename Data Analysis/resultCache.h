@@ -0,0 +1,213 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+// Per-run cache of the analysis results, so that the HV scan macros only reprocess the runs
+// that changed. The HitHistograms of Data/runNNNN.root are stored in Data/runNNNN.results.root
+// together with a key describing everything they depend on:
+//   - size and modification time of the run file,
+//   - the analysis configuration: kHitHistogramsVersion, detectors and their names, trigger,
+//     histogram binning, clustering, tracking and bootstrap settings, a fingerprint of the mapping
+//     and the checksum of the channel mask.
+// The cached results are used only if the stored key is identical; otherwise the run is
+// processed again and its cache rewritten.
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <RtypesCore.h>
+#include <TFile.h>
+#include <TH1F.h>
+#include <TH1I.h>
+#include <TNamed.h>
+#include <TParameter.h>
+#include <TTree.h>
+#include "detectorSetup.h"
+#include "hitHistograms.h"
+
+// Result cache file belonging to a run file: Data/run6586.root -> Data/run6586.results.root.
+inline std::string resultCachePath(const std::string& rootFile)
+{
+    size_t dot = rootFile.rfind(".root");
+    return (dot == std::string::npos ? rootFile : rootFile.substr(0, dot)) + ".results.root";
+}
+
+// Key of the results of a run; empty if the run file does not exist, in which case nothing is cached.
+inline std::string resultCacheKey(const std::string& rootFile, const DetectorSetup& setup)
+{
+    struct stat st;
+    if (stat(rootFile.c_str(), &st) != 0) return "";
+
+    std::ostringstream key;
+    key << "version " << kHitHistogramsVersion << "\n";
+    key << "file " << st.st_size << " " << st.st_mtime << "\n";
+    key << "mapping " << std::hex << mappingFingerprint(*setup.mapping) << std::dec << "\n";
+    key << "mask " << std::hex << channelMaskChecksum(setup.mask) << std::dec << "\n";
+    key << "trigger " << setup.triggerId << "\n";
+    key << "detectors";
+    for (int id : setup.ids) key << " " << id << ":" << setup.idToName.at(id);
+    key << "\nbinning";
+    for (const HistogramBinning& b : {kHitsBinning, kMaxQBinning, kTotalQBinning, kClustersBinning, kClusterSizeBinning,
+                                      kClusterChargeBinning, kCentroidBinning}) {
+        key << " " << b.bins << "/" << b.min << "/" << b.max;
+    }
+    key << "\nclustering " << setup.clustering.maxGap << " " << setup.clustering.chargeThreshold << "\n";
+    key << "tracking " << setup.tracking.residualWindow;
+    for (int c = 0; c < kNumChambers; ++c) {
+        key << " " << setup.tracking.z[c] << "/" << setup.tracking.pitch[c] << "/" << setup.tracking.offset[c]
+            << "/" << setup.tracking.stripMin[c] << "-" << setup.tracking.stripMax[c];
+    }
+    key << "\n";
+    key << "bootstrap " << setup.bootstrapReplicas << "\n";
+    return key.str();
+}
+
+// Writes the results of a run with its key. Returns false (and prints the reason) on failure.
+inline bool writeResultCache(const std::string& path, const std::string& key, const HitHistograms& run)
+{
+    std::unique_ptr<TFile> file(TFile::Open(path.c_str(), "RECREATE"));
+    if (!file || file->IsZombie()) {
+        std::cerr << "Error creating result cache: " << path << std::endl;
+        return false;
+    }
+
+    TNamed("key", key.c_str()).Write();
+    TParameter<Long64_t>("events", run.events).Write();
+
+    // Owned by the file.
+    TTree* counts = new TTree("counts", "Per-detector counts");
+    int id;
+    ULong64_t fired, tracks, matched;
+    double residualMean, residualRms;
+    counts->Branch("id", &id);
+    counts->Branch("fired", &fired);
+    counts->Branch("tracks", &tracks);
+    counts->Branch("matched", &matched);
+    counts->Branch("residualMean", &residualMean);
+    counts->Branch("residualRms", &residualRms);
+
+    for (const auto& entry : run.hits) {
+        id = entry.first;
+        fired = run.fired.count(id) ? run.fired.at(id) : 0;
+        tracks = run.tracks.count(id) ? run.tracks.at(id) : 0;
+        matched = run.matched.count(id) ? run.matched.at(id) : 0;
+        residualMean = run.residualMean.count(id) ? run.residualMean.at(id) : 0.;
+        residualRms = run.residualRms.count(id) ? run.residualRms.at(id) : 0.;
+        counts->Fill();
+
+        run.hits.at(id)->Write(Form("hits_%d", id));
+        run.maxQ.at(id)->Write(Form("maxQ_%d", id));
+        run.totalQ.at(id)->Write(Form("totalQ_%d", id));
+        run.clusters.at(id)->Write(Form("clusters_%d", id));
+        run.clusterSize.at(id)->Write(Form("clusterSize_%d", id));
+        run.clusterCharge.at(id)->Write(Form("clusterCharge_%d", id));
+        run.clusterCentroid.at(id)->Write(Form("clusterCentroid_%d", id));
+    }
+    counts->Write();
+
+    TTree* bootstrap = new TTree("bootstrap", "Bootstrap samples per detector and quantity");
+    int quantity;
+    double nominal, standardError;
+    std::vector<double> replicas;
+    bootstrap->Branch("id", &id);
+    bootstrap->Branch("quantity", &quantity);
+    bootstrap->Branch("nominal", &nominal);
+    bootstrap->Branch("standardError", &standardError);
+    bootstrap->Branch("replicas", &replicas);
+    for (const auto& entry : run.bootstrap) {
+        id = entry.first;
+        for (quantity = 0; quantity < kNumBootstrapQuantities; ++quantity) {
+            nominal = entry.second.nominal[quantity];
+            standardError = entry.second.standardError[quantity];
+            replicas = entry.second.replicas[quantity];
+            bootstrap->Fill();
+        }
+    }
+    bootstrap->Write();
+    file->Close();
+    return true;
+}
+
+template <typename T>
+T* readCachedHistogram(TFile& file, const char* name)
+{
+    T* h = file.Get<T>(name);
+    if (h) h->SetDirectory(nullptr); // keep it after the file is closed
+    return h;
+}
+
+// Reads the cached results of a run into `run` if the cache exists and its key matches.
+inline bool readResultCache(const std::string& path, const std::string& key, const DetectorSetup& setup, HitHistograms& run)
+{
+    struct stat st;
+    if (key.empty() || stat(path.c_str(), &st) != 0) return false;
+
+    std::unique_ptr<TFile> file(TFile::Open(path.c_str()));
+    if (!file || file->IsZombie()) return false;
+
+    TNamed* storedKey = file->Get<TNamed>("key");
+    TParameter<Long64_t>* events = file->Get<TParameter<Long64_t>>("events");
+    TTree* counts = file->Get<TTree>("counts");
+    TTree* bootstrap = file->Get<TTree>("bootstrap");
+    if (!storedKey || key != storedKey->GetTitle() || !events || !counts || !bootstrap) return false;
+
+    HitHistograms cached;
+    cached.events = events->GetVal();
+
+    int id;
+    ULong64_t fired, tracks, matched;
+    double residualMean, residualRms;
+    counts->SetBranchAddress("id", &id);
+    counts->SetBranchAddress("fired", &fired);
+    counts->SetBranchAddress("tracks", &tracks);
+    counts->SetBranchAddress("matched", &matched);
+    counts->SetBranchAddress("residualMean", &residualMean);
+    counts->SetBranchAddress("residualRms", &residualRms);
+    for (Long64_t entry = 0; entry < counts->GetEntries(); ++entry) {
+        counts->GetEntry(entry);
+        cached.fired[id] = fired;
+        cached.tracks[id] = tracks;
+        cached.matched[id] = matched;
+        cached.residualMean[id] = residualMean;
+        cached.residualRms[id] = residualRms;
+    }
+
+    int quantity;
+    double nominal, standardError;
+    std::vector<double>* replicas = nullptr;
+    bootstrap->SetBranchAddress("id", &id);
+    bootstrap->SetBranchAddress("quantity", &quantity);
+    bootstrap->SetBranchAddress("nominal", &nominal);
+    bootstrap->SetBranchAddress("standardError", &standardError);
+    bootstrap->SetBranchAddress("replicas", &replicas);
+    for (Long64_t entry = 0; entry < bootstrap->GetEntries(); ++entry) {
+        bootstrap->GetEntry(entry);
+        if (quantity < 0 || quantity >= kNumBootstrapQuantities || !replicas) continue;
+        cached.bootstrap[id].nominal[quantity] = nominal;
+        cached.bootstrap[id].standardError[quantity] = standardError;
+        cached.bootstrap[id].replicas[quantity] = *replicas;
+    }
+    delete replicas;
+
+    for (int id : setup.ids) {
+        cached.hits[id] = readCachedHistogram<TH1I>(*file, Form("hits_%d", id));
+        cached.maxQ[id] = readCachedHistogram<TH1F>(*file, Form("maxQ_%d", id));
+        cached.totalQ[id] = readCachedHistogram<TH1F>(*file, Form("totalQ_%d", id));
+        cached.clusters[id] = readCachedHistogram<TH1I>(*file, Form("clusters_%d", id));
+        cached.clusterSize[id] = readCachedHistogram<TH1I>(*file, Form("clusterSize_%d", id));
+        cached.clusterCharge[id] = readCachedHistogram<TH1F>(*file, Form("clusterCharge_%d", id));
+        cached.clusterCentroid[id] = readCachedHistogram<TH1F>(*file, Form("clusterCentroid_%d", id));
+        if (!cached.hits[id] || !cached.maxQ[id] || !cached.totalQ[id] || !cached.clusters[id] || !cached.clusterSize[id] ||
+            !cached.clusterCharge[id] || !cached.clusterCentroid[id]) {
+            std::cerr << "Incomplete result cache " << path << ", processing the run again." << std::endl;
+            return false;
+        }
+    }
+
+    run = cached;
+    return true;
+}
+
+#endif
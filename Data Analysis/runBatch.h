@@ -0,0 +1,143 @@
+#ifndef RUN_BATCH_H
+#define RUN_BATCH_H
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RDFHelpers.hxx>
+#include <TFile.h>
+#include <TTree.h>
+#include "hitCache.h"
+#include "hitHistograms.h"
+#include "resultCache.h"
+
+// Run name of a run file: Data/run6586.root -> run6586.
+inline std::string runName(const std::string& file)
+{
+    std::string run = file.substr(file.find_last_of('/') + 1);
+    return run.substr(0, run.find('.'));
+}
+
+// One run of the HV scan: run file and HV (V) of the detectors under test.
+struct RunInfo {
+    std::string file;
+    double hv;
+};
+
+const char* const kDefaultRunList = "Data/runs.cfg";
+
+// Reads the run list of the HV scan, one "file HV" line per run; lines starting with '#' are
+// comments. Returns an empty list (and prints the reason) if the file cannot be read.
+inline std::vector<RunInfo> loadRunList(const std::string& path = kDefaultRunList)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Error opening run list: " << path << std::endl;
+        return {};
+    }
+
+    std::vector<RunInfo> runs;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream tokens(line);
+        RunInfo run;
+        if (!(tokens >> run.file) || run.file[0] == '#') continue;
+        if (!(tokens >> run.hv)) {
+            std::cerr << path << ":" << lineNumber << ": expected a run file and its HV" << std::endl;
+            return {};
+        }
+        runs.push_back(run);
+    }
+    return runs;
+}
+
+// Process all runs of an HV scan at once: the HitHistograms of every run are booked
+// up front and the event loops of all runs are executed together by RunGraphs, so
+// the thread pool is shared across files instead of processing them one by one.
+// Runs with an up-to-date hit cache (see convertHits.C), converted with the mapping and
+// channel mask of the setup, are read from the cache instead of the raw tree, and runs
+// whose results are cached for the same run file and analysis configuration (see
+// resultCache.h) are not processed at all. Returns one entry per file, in the same order;
+// runs that cannot be read give an empty HitHistograms (no histograms, zero events).
+inline std::vector<HitHistograms> processRuns(const std::vector<std::string>& files, const DetectorSetup& setup)
+{
+    std::vector<std::unique_ptr<ROOT::RDataFrame>> frames;
+    std::vector<ROOT::RDF::RResultPtr<HitHistograms>> booked(files.size());
+    std::vector<ROOT::RDF::RResultHandle> handles;
+    std::vector<std::unique_ptr<HitCacheReader>> caches(files.size());
+    std::vector<HitHistograms> results(files.size());
+    std::vector<std::string> keys(files.size());
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        keys[i] = resultCacheKey(files[i], setup);
+        if (readResultCache(resultCachePath(files[i]), keys[i], setup, results[i])) continue;
+
+        if (isHitCacheCurrent(files[i])) {
+            caches[i].reset(new HitCacheReader(hitCachePath(files[i])));
+            if (!caches[i]->IsValid()) {
+                std::cerr << "Invalid hit cache " << hitCachePath(files[i]) << ", reading the raw tree instead." << std::endl;
+            } else if (caches[i]->GetMappingFingerprint() != mappingFingerprint(*setup.mapping)) {
+                std::cerr << "Hit cache " << hitCachePath(files[i]) << " was converted with another mapping"
+                          << ", reading the raw tree instead." << std::endl;
+            } else if (caches[i]->GetMaskChecksum() != channelMaskChecksum(setup.mask)) {
+                std::cerr << "Hit cache " << hitCachePath(files[i]) << " was converted with another channel mask"
+                          << ", reading the raw tree instead." << std::endl;
+            } else {
+                continue;
+            }
+            caches[i].reset();
+        }
+
+        // The file is only opened here to check it; it must be closed again before booking,
+        // otherwise the new histograms would be attached to it.
+        {
+            std::unique_ptr<TFile> file(TFile::Open(files[i].c_str()));
+            if (!file || file->IsZombie()) {
+                std::cerr << "Error opening file: " << files[i] << std::endl;
+                continue;
+            }
+            if (!file->Get("raw")) {
+                std::cerr << "Tree 'raw' not found in file: " << files[i] << std::endl;
+                continue;
+            }
+        }
+
+        frames.emplace_back(new ROOT::RDataFrame("raw", files[i]));
+        ROOT::RDataFrame& df = *frames.back();
+        // Histogram names get the run name appended, so the runs do not replace each other in memory.
+        booked[i] = bookOnRawHits(df, HitHistogramsHelper(setup, df.GetNSlots(), "_" + runName(files[i])));
+        handles.emplace_back(booked[i]);
+    }
+
+    if (!handles.empty()) ROOT::RDF::RunGraphs(handles);
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (booked[i]) results[i] = *booked[i];
+    }
+
+    unsigned int nSlots = ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!caches[i]) continue;
+        HitHistogramsHelper helper(setup, nSlots, "_" + runName(files[i]));
+        forEachCachedEvent(*caches[i], nSlots, [&](unsigned int slot, uint64_t, const EventHits& hits) {
+            helper.Fill(slot, hits);
+        });
+        helper.Finalize();
+        results[i] = *helper.GetResultPtr();
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if ((booked[i] || caches[i]) && !keys[i].empty()) writeResultCache(resultCachePath(files[i]), keys[i], results[i]);
+    }
+    return results;
+}
+
+#endif
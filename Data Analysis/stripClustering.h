@@ -0,0 +1,127 @@
+#ifndef STRIP_CLUSTERING_H
+#define STRIP_CLUSTERING_H
+
+// Strip clustering per chamber.
+//
+// Fired strips of every chamber are marked in a 256-bit occupancy mask (strips 0-255) with their
+// charge in a 256-entry array. The clusters are found by one ordered scan over the set bits of the
+// mask: a strip starts a new cluster when more than maxGap strips are missing since the previous
+// fired strip. The masks and the charges are cleared during the scan, and the cluster list keeps
+// its capacity, so a StripClusterer does not allocate after the first events. One per slot.
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "apvMapping.h"
+#include "hitCache.h"
+
+struct ClusterSettings {
+    unsigned int maxGap = 1;     // missing strips allowed inside a cluster, 0 for strictly adjacent strips
+    float chargeThreshold = 0.f; // minimum maxQ (ADC) of a strip to be clustered
+};
+
+struct StripCluster {
+    Chamber chamber;
+    uint16_t size;    // number of fired strips
+    float charge;     // sum of the maxQ of its strips
+    float centroid;   // charge-weighted mean strip
+};
+
+const unsigned int kClusterStrips = 256;
+
+class StripClusterer {
+public:
+    explicit StripClusterer(const ClusterSettings& settings = ClusterSettings()) : fSettings(settings)
+    {
+        std::memset(fMask, 0, sizeof(fMask));
+        std::memset(fCharge, 0, sizeof(fCharge));
+    }
+
+    // Clusters the hits of one event; the result is valid until the next call.
+    void Process(const EventHits& hits)
+    {
+        fClusters.clear();
+        uint32_t touched = 0;
+
+        for (size_t i = 0; i < hits.n; ++i) {
+            Chamber chamber = Chamber(hits.chamber[i]);
+            uint16_t strip = hits.strip[i];
+            if (chamber >= kNumChambers || strip >= kClusterStrips || hits.maxQ[i] < fSettings.chargeThreshold) continue;
+
+            fMask[chamber][strip >> 6] |= uint64_t(1) << (strip & 63);
+            fCharge[chamber][strip] += hits.maxQ[i];
+            touched |= 1u << chamber;
+        }
+
+        for (int chamber = 0; chamber < kNumChambers; ++chamber) {
+            fFirst[chamber] = fClusters.size();
+            if (touched & (1u << chamber)) Scan(Chamber(chamber));
+            fCount[chamber] = fClusters.size() - fFirst[chamber];
+        }
+    }
+
+    const std::vector<StripCluster>& GetClusters() const { return fClusters; }
+
+    unsigned int GetCount(Chamber chamber) const { return fCount[chamber]; }
+
+    const StripCluster* GetClusters(Chamber chamber) const { return fClusters.data() + fFirst[chamber]; }
+
+    // Cluster with the highest charge in a chamber, nullptr if there is none.
+    const StripCluster* GetLeading(Chamber chamber) const
+    {
+        const StripCluster* leading = nullptr;
+        for (const StripCluster* c = GetClusters(chamber); c != GetClusters(chamber) + fCount[chamber]; ++c) {
+            if (!leading || c->charge > leading->charge) leading = c;
+        }
+        return leading;
+    }
+
+private:
+    void Scan(Chamber chamber)
+    {
+        StripCluster cluster = {chamber, 0, 0.f, 0.f};
+        float weighted = 0.f; // sum of charge * strip
+        int stripSum = 0;
+        int last = -1;
+
+        auto close = [&]() {
+            // Clusters without positive charge get their geometric centre.
+            cluster.centroid = cluster.charge > 0.f ? weighted / cluster.charge : (float)stripSum / cluster.size;
+            fClusters.push_back(cluster);
+            cluster.size = 0;
+            cluster.charge = 0.f;
+            weighted = 0.f;
+            stripSum = 0;
+        };
+
+        for (unsigned int word = 0; word < kClusterStrips / 64; ++word) {
+            uint64_t bits = fMask[chamber][word];
+            fMask[chamber][word] = 0;
+
+            while (bits) {
+                int strip = word * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                if (cluster.size > 0 && strip - last - 1 > (int)fSettings.maxGap) close();
+
+                float q = fCharge[chamber][strip];
+                fCharge[chamber][strip] = 0.f;
+                cluster.size++;
+                cluster.charge += q;
+                weighted += q * strip;
+                stripSum += strip;
+                last = strip;
+            }
+        }
+        if (cluster.size > 0) close();
+    }
+
+    ClusterSettings fSettings;
+    uint64_t fMask[kNumChambers][kClusterStrips / 64];
+    float fCharge[kNumChambers][kClusterStrips];
+    std::vector<StripCluster> fClusters;
+    unsigned int fFirst[kNumChambers] = {};
+    unsigned int fCount[kNumChambers] = {};
+};
+
+#endif
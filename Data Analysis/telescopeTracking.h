@@ -0,0 +1,245 @@
+#ifndef TELESCOPE_TRACKING_H
+#define TELESCOPE_TRACKING_H
+
+// Straight-line tracking with the TRK_IN/TRK_OUT telescope, for tracking-based DUT efficiencies.
+//
+// An event gives a track if all four telescope planes (TRK_IN_X/Y, TRK_OUT_X/Y) have a cluster;
+// the leading cluster of each plane is used. The DUTs measure x, so the x projection is fitted by
+// least squares through the x planes and extrapolated to every DUT. A track counts for a DUT only
+// if its predicted position lies inside the active strips of the DUT, at least the residual
+// window away from the edges; it is matched if the nearest cluster of the DUT lies within the
+// residual window.
+//
+// Tracks are not fitted one by one: TrackFitter collects them in fixed-size batches stored as
+// structure of arrays and fits a whole batch with loops over the tracks, which the compiler
+// vectorizes. The buffers keep their capacity between batches, so after the first batches
+// nothing is allocated per track. One TrackFitter per slot.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "apvMapping.h"
+#include "stripClustering.h"
+
+const int kNumDuts = kDut06 - kDut01 + 1;
+const int kTrackBatch = 256;
+
+// Telescope planes measuring x, used in the fit; the y planes are only required to have a cluster.
+const Chamber kTelescopeX[] = {kTrkInX, kTrkOutX};
+const Chamber kTelescopeY[] = {kTrkInY, kTrkOutY};
+const int kNumTelescopeX = sizeof(kTelescopeX) / sizeof(kTelescopeX[0]);
+
+// Geometry of the stack and matching window. A cluster at strip s of chamber c is at position
+// offset[c] + pitch[c] * s and at height z[c]; the active strips of chamber c are stripMin[c] to
+// stripMax[c] (loadDetectorSetup() takes them from the mapping). The defaults put the chambers at
+// their plane number (TRK_IN 1, DUT_01-06 2-7, TRK_OUT 8) with positions in strips and no
+// alignment corrections; the measured geometry is read from Data/geometry.cfg
+// (loadTrackingSettings()), and the mean residuals printed by efficiency() give the offsets to correct.
+struct TrackingSettings {
+    float z[kNumChambers];
+    float pitch[kNumChambers];
+    float offset[kNumChambers];
+    float stripMin[kNumChambers];
+    float stripMax[kNumChambers];
+    float residualWindow = 5.f;
+
+    TrackingSettings()
+    {
+        for (int c = 0; c < kNumChambers; ++c) {
+            z[c] = 0.f;
+            pitch[c] = 1.f;
+            offset[c] = 0.f;
+            stripMin[c] = 0.f;
+            stripMax[c] = kClusterStrips - 1;
+        }
+        z[kTrkInX] = z[kTrkInY] = 1.f;
+        for (int d = 0; d < kNumDuts; ++d) z[kDut01 + d] = 2.f + d;
+        z[kTrkOutX] = z[kTrkOutY] = 8.f;
+    }
+};
+
+const char* const kDefaultGeometryFile = "Data/geometry.cfg";
+
+// Reads the tracking geometry into settings: one "chamber z pitch offset" line per chamber, with
+// the chamber names of the mapping file, and a "window residualWindow" line; chambers not listed
+// keep their settings. Lines starting with '#' are comments. Returns false (and prints the
+// reason) if the file cannot be read or puts the telescope x planes at the same z.
+inline bool loadTrackingSettings(const std::string& path, TrackingSettings& settings)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Error opening geometry file: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream tokens(line);
+        std::string first;
+        if (!(tokens >> first) || first[0] == '#') continue;
+
+        if (first == "window") {
+            if (!(tokens >> settings.residualWindow) || settings.residualWindow <= 0.f) {
+                std::cerr << path << ":" << lineNumber << ": expected a positive residual window" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        Chamber chamber = chamberFromName(first);
+        float z, pitch, offset;
+        if (chamber == kNoChamber || !(tokens >> z >> pitch >> offset) || pitch == 0.f) {
+            std::cerr << path << ":" << lineNumber << ": expected \"chamber z pitch offset\"" << std::endl;
+            return false;
+        }
+        settings.z[chamber] = z;
+        settings.pitch[chamber] = pitch;
+        settings.offset[chamber] = offset;
+    }
+
+    // The x planes of the telescope must not all be at the same height, or the fit has no solution.
+    bool sameZ = true;
+    for (Chamber plane : kTelescopeX) sameZ = sameZ && settings.z[plane] == settings.z[kTelescopeX[0]];
+    if (sameZ) {
+        std::cerr << path << ": the telescope x planes (" << kChamberNames[kTelescopeX[0]] << ", "
+                  << kChamberNames[kTelescopeX[kNumTelescopeX - 1]] << ") must be at different z" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Per-DUT counts, indexed by DUT (0 for DUT_01).
+struct TrackingCounts {
+    uint64_t tracks[kNumDuts] = {};
+    uint64_t matched[kNumDuts] = {};
+    double residualSum[kNumDuts] = {};  // of the matched tracks
+    double residualSum2[kNumDuts] = {};
+
+    void Add(const TrackingCounts& other)
+    {
+        for (int d = 0; d < kNumDuts; ++d) {
+            tracks[d] += other.tracks[d];
+            matched[d] += other.matched[d];
+            residualSum[d] += other.residualSum[d];
+            residualSum2[d] += other.residualSum2[d];
+        }
+    }
+};
+
+class TrackFitter {
+public:
+    explicit TrackFitter(const TrackingSettings& settings = TrackingSettings()) : fSettings(settings)
+    {
+        // Unweighted least squares with fixed plane positions: the sums over z are the same for all tracks.
+        fSz = fSzz = 0.f;
+        for (int p = 0; p < kNumTelescopeX; ++p) {
+            float z = settings.z[kTelescopeX[p]];
+            fSz += z;
+            fSzz += z * z;
+        }
+        fInvDet = 1.f / (kNumTelescopeX * fSzz - fSz * fSz);
+    }
+
+    // Adds the track of an event, if it has one, and returns whether it has. The batch is fitted
+    // when it is full.
+    bool Add(const StripClusterer& clusters)
+    {
+        for (Chamber plane : kTelescopeY) {
+            if (clusters.GetCount(plane) == 0) return false;
+        }
+        for (Chamber plane : kTelescopeX) {
+            if (clusters.GetCount(plane) == 0) return false;
+        }
+
+        for (int p = 0; p < kNumTelescopeX; ++p) {
+            fX[p][fN] = Position(kTelescopeX[p], clusters.GetLeading(kTelescopeX[p])->centroid);
+        }
+        for (int d = 0; d < kNumDuts; ++d) {
+            Chamber dut = Chamber(kDut01 + d);
+            unsigned int n = clusters.GetCount(dut);
+            const StripCluster* c = clusters.GetClusters(dut);
+            fDutFirst[d][fN] = fDutPositions[d].size();
+            fDutCount[d][fN] = n;
+            for (unsigned int k = 0; k < n; ++k) fDutPositions[d].push_back(Position(dut, c[k].centroid));
+        }
+
+        if (++fN == kTrackBatch) Flush();
+        return true;
+    }
+
+    // Fits the pending tracks and adds them to the counts.
+    void Flush()
+    {
+        const int n = fN;
+        const float nPlanes = kNumTelescopeX;
+        float slope[kTrackBatch], intercept[kTrackBatch];
+
+        for (int t = 0; t < n; ++t) {
+            float sx = 0.f, szx = 0.f;
+            for (int p = 0; p < kNumTelescopeX; ++p) {
+                sx += fX[p][t];
+                szx += fSettings.z[kTelescopeX[p]] * fX[p][t];
+            }
+            slope[t] = (nPlanes * szx - fSz * sx) * fInvDet;
+            intercept[t] = (fSzz * sx - fSz * szx) * fInvDet;
+        }
+
+        const float window = fSettings.residualWindow;
+        for (int d = 0; d < kNumDuts; ++d) {
+            const Chamber dut = Chamber(kDut01 + d);
+            const float z = fSettings.z[dut];
+            const float edge1 = Position(dut, fSettings.stripMin[dut]), edge2 = Position(dut, fSettings.stripMax[dut]);
+            const float low = std::min(edge1, edge2) + window, high = std::max(edge1, edge2) - window;
+            const float* positions = fDutPositions[d].data();
+            int tracks = 0, matched = 0;
+            float sum = 0.f, sum2 = 0.f;
+
+            for (int t = 0; t < n; ++t) {
+                float predicted = intercept[t] + slope[t] * z;
+                bool accepted = predicted >= low && predicted <= high;
+                float best = kNoCluster;
+                for (unsigned int k = fDutFirst[d][t]; k < fDutFirst[d][t] + fDutCount[d][t]; ++k) {
+                    float r = positions[k] - predicted;
+                    best = std::fabs(r) < std::fabs(best) ? r : best;
+                }
+                bool hit = accepted && std::fabs(best) <= window;
+                tracks += accepted;
+                matched += hit;
+                sum += hit ? best : 0.f;
+                sum2 += hit ? best * best : 0.f;
+            }
+
+            fCounts.tracks[d] += tracks;
+            fCounts.matched[d] += matched;
+            fCounts.residualSum[d] += sum;
+            fCounts.residualSum2[d] += sum2;
+            fDutPositions[d].clear();
+        }
+        fN = 0;
+    }
+
+    // Counts of the fitted tracks; call Flush() first to include the pending ones.
+    const TrackingCounts& GetCounts() const { return fCounts; }
+
+private:
+    static constexpr float kNoCluster = 1e30f;
+
+    float Position(Chamber chamber, float strip) const { return fSettings.offset[chamber] + fSettings.pitch[chamber] * strip; }
+
+    TrackingSettings fSettings;
+    float fSz, fSzz, fInvDet;
+    int fN = 0;
+    float fX[kNumTelescopeX][kTrackBatch];
+    uint32_t fDutFirst[kNumDuts][kTrackBatch];  // first cluster of the track in fDutPositions
+    uint16_t fDutCount[kNumDuts][kTrackBatch];  // clusters of the DUT in the event of the track
+    std::vector<float> fDutPositions[kNumDuts]; // cluster positions of the pending tracks
+    TrackingCounts fCounts;
+};
+
+#endif